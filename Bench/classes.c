@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dlmall.h"
+#include "trace.h"
+
+// Derives a size class layout for the Flists engine from a recorded trace,
+// and prints it in the format load_classes() reads:
+//
+//     ./classes run.trace > run.classes
+//     DALLOC_CLASSES=run.classes ./myprog
+//
+// The class sizes are chosen so that the requests in the trace, rounded up to
+// their class, waste as few bytes as possible. Each class starts out with as
+// many blocks as were live at the same time, scaled down if that would take
+// more than the budget.
+
+#define ALIGN 8
+#define ARENA_LIMIT (1 << 20) // larger than any request that can succeed
+#define HEAD 16 // size of a block header in the engines, 24 with -DRELATIVE_LINKS=0
+
+int adjust(uint32_t request)
+{
+    // Far beyond any class, and rounding up must not overflow
+    if(request > ARENA_LIMIT)
+    {
+        request = ARENA_LIMIT;
+    }
+    int size = (request + ALIGN - 1) / ALIGN * ALIGN;
+    if(size < 8)
+    {
+        size = 8;
+    }
+    return size;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2 || argc > 4)
+    {
+        printf("usage: %s <trace file> [largest class] [budget bytes]\n", argv[0]);
+        return 1;
+    }
+    int largest = 128;
+    long budget = 16 * 1024;
+    if(argc > 2)
+    {
+        largest = atoi(argv[2]) / ALIGN * ALIGN;
+    }
+    if(argc > 3)
+    {
+        budget = atol(argv[3]);
+    }
+    if(largest < ALIGN)
+    {
+        printf("The largest class must be at least %d bytes\n", ALIGN);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if(file == NULL)
+    {
+        printf("Could not open trace file %s\n", argv[1]);
+        return 1;
+    }
+    struct trace_header header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC || header.version < 1 || header.version > TRACE_VERSION)
+    {
+        printf("%s is not a trace file\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long count = (ftell(file) - sizeof(header)) / sizeof(struct trace_record);
+    fseek(file, sizeof(header), SEEK_SET);
+    struct trace_record *records = malloc(count * sizeof(struct trace_record));
+    if(records == NULL || fread(records, sizeof(struct trace_record), count, file) != (size_t) count)
+    {
+        printf("Could not read %s\n", argv[1]);
+        free(records);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+    long i;
+    for(i = 0; i < count; i ++)
+    {
+        if(header.version == 1 && records[i].size == 0)
+        {
+            records[i].size = TRACE_FREE;
+        }
+        if(records[i].id > count || (records[i].id == 0 && records[i].size == TRACE_FREE))
+        {
+            printf("%s is not a valid trace, record %ld has id %u\n", argv[1], i, records[i].id);
+            free(records);
+            return 1;
+        }
+    }
+
+    // How often each size, up to the largest class, was asked for
+    int n = largest / ALIGN;
+    long *hits = calloc(n + 1, sizeof(long));
+    for(i = 0; i < count; i ++)
+    {
+        if(records[i].size != TRACE_FREE && adjust(records[i].size) <= largest)
+        {
+            hits[adjust(records[i].size) / ALIGN] ++;
+        }
+    }
+
+    // best[k][j] is the least waste for sizes up to j * ALIGN with k classes,
+    // the largest of them j * ALIGN, and from[k][j] where the class below it is
+    long best[CLASSES + 1][n + 1];
+    int from[CLASSES + 1][n + 1];
+    int j;
+    int k;
+    for(j = 0; j <= n; j ++)
+    {
+        best[0][j] = j == 0 ? 0 : -1;
+    }
+    for(k = 1; k <= CLASSES; k ++)
+    {
+        best[k][0] = -1;
+        for(j = 1; j <= n; j ++)
+        {
+            best[k][j] = -1;
+            long waste = 0;
+            int b;
+            // The class of size j takes every size above b
+            for(b = j - 1; b >= 0; b --)
+            {
+                waste = waste + hits[b + 1] * (long) (j - b - 1) * ALIGN;
+                if(best[k - 1][b] >= 0 && (best[k][j] < 0 || best[k - 1][b] + waste < best[k][j]))
+                {
+                    best[k][j] = best[k - 1][b] + waste;
+                    from[k][j] = b;
+                }
+            }
+        }
+    }
+
+    // Fewer classes are fine if they waste no more, and the top class is the
+    // largest size that was asked for
+    int top = n;
+    while(top > 1 && hits[top] == 0)
+    {
+        top --;
+    }
+    int used = 1;
+    for(k = 1; k <= CLASSES && k <= top; k ++)
+    {
+        if(best[k][top] >= 0 && best[k][top] < best[used][top])
+        {
+            used = k;
+        }
+    }
+    int sizes[CLASSES + 1];
+    j = top;
+    for(k = used; k >= 1; k --)
+    {
+        sizes[k] = j * ALIGN;
+        j = from[k][j];
+    }
+
+    // Replay the trace to find how many blocks of each class were live at once
+    int *class_of = calloc(n + 1, sizeof(int));
+    k = 1;
+    for(j = 1; j <= top; j ++)
+    {
+        if(sizes[k] < j * ALIGN)
+        {
+            k ++;
+        }
+        class_of[j] = k;
+    }
+    uint32_t *owner = calloc(count + 1, sizeof(uint32_t));
+    long live[CLASSES + 1] = {0};
+    long peak[CLASSES + 1] = {0};
+    for(i = 0; i < count; i ++)
+    {
+        struct trace_record *rec = &records[i];
+        if(rec->size != TRACE_FREE)
+        {
+            int size = adjust(rec->size);
+            if(rec->id == 0 || size > top * ALIGN)
+            {
+                continue;
+            }
+            k = class_of[size / ALIGN];
+            owner[rec->id] = k;
+            live[k] ++;
+            if(live[k] > peak[k])
+            {
+                peak[k] = live[k];
+            }
+        }
+        else if(owner[rec->id] != 0)
+        {
+            live[owner[rec->id]] --;
+            owner[rec->id] = 0;
+        }
+    }
+
+    long bytes = 0;
+    for(k = 1; k <= used; k ++)
+    {
+        bytes = bytes + peak[k] * (sizes[k] + HEAD);
+    }
+    printf("# size classes from %s, %ld bytes wasted rounding up\n", argv[1], best[used][top]);
+    printf("# size capacity\n");
+    for(k = 1; k <= used; k ++)
+    {
+        long capacity = peak[k];
+        if(bytes > budget)
+        {
+            capacity = capacity * budget / bytes;
+        }
+        printf("%d %ld\n", sizes[k], capacity);
+    }
+
+    free(owner);
+    free(class_of);
+    free(hits);
+    free(records);
+    return 0;
+}
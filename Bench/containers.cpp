@@ -0,0 +1,209 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <list>
+#include <memory_resource>
+#include "dlmall.hpp"
+
+// Times the standard containers with std::allocator against the same
+// containers on the Flists engine, through dlmall::allocator and through the
+// heap, region and pool memory resources. Every run prints one line:
+//
+//     <container> <allocator> rounds: <n> ns/round: <n> check: <n>
+//
+// A round builds a container of ELEMENTS elements, works on it and throws it
+// away. The engine's arena is only 64 kbytes, so the containers are kept
+// small and the rounds many. With the region the memory of a round is given
+// back with release() instead of being freed one element at a time.
+//
+// Build the engine as C and the benchmark as C++:
+//
+//     gcc -O2 -c -IFlists Flists/dlmall.c
+//     g++ -O2 -std=c++17 -IFlists Bench/containers.cpp dlmall.o -o containers
+//     ./containers [rounds]
+
+#define ELEMENTS 256
+
+// Big enough for a node of any of the containers below, the largest being a
+// std::map node at 40 bytes
+#define NODE 48
+
+double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void report(const char *container, const char *allocator, long rounds, double took, long check)
+{
+    printf("%s %s rounds: %ld ns/round: %.0f check: %ld\n", container, allocator, rounds, took * 1e9 / rounds, check);
+}
+
+// Each workload returns something computed from the container, so that the
+// compiler cannot leave the work out and the runs can be compared
+
+template<typename Vector>
+long vector_round(Vector &numbers)
+{
+    int i;
+    for(i = 0; i < ELEMENTS; i ++)
+    {
+        numbers.push_back(i);
+    }
+    long sum = 0;
+    for(int n : numbers)
+    {
+        sum = sum + n;
+    }
+    return sum;
+}
+
+template<typename Map>
+long map_round(Map &numbers)
+{
+    int i;
+    for(i = 0; i < ELEMENTS; i ++)
+    {
+        numbers[(i * 7919) % ELEMENTS] = i;
+    }
+    for(i = 0; i < ELEMENTS; i = i + 2)
+    {
+        numbers.erase(i);
+    }
+    long sum = 0;
+    for(auto &pair : numbers)
+    {
+        sum = sum + pair.second;
+    }
+    return sum;
+}
+
+template<typename List>
+long list_round(List &numbers)
+{
+    int i;
+    for(i = 0; i < ELEMENTS; i ++)
+    {
+        if(i % 2 == 0)
+        {
+            numbers.push_back(i);
+        }
+        else
+        {
+            numbers.push_front(i);
+        }
+    }
+    numbers.remove_if([](int n) { return n % 3 == 0; });
+    long sum = 0;
+    for(int n : numbers)
+    {
+        sum = sum + n;
+    }
+    return sum;
+}
+
+// Runs a workload with a container that has its own allocator
+template<typename Container, typename Round>
+void run(const char *container, const char *allocator, long rounds, Round round)
+{
+    long check = 0;
+    double start = now();
+    long r;
+    for(r = 0; r < rounds; r ++)
+    {
+        Container numbers;
+        check = check + round(numbers);
+    }
+    report(container, allocator, rounds, now() - start, check);
+}
+
+// Runs a workload with a std::pmr container on the given resource
+template<typename Container, typename Round>
+void run_pmr(const char *container, const char *allocator, long rounds, std::pmr::memory_resource *resource, Round round)
+{
+    long check = 0;
+    double start = now();
+    long r;
+    for(r = 0; r < rounds; r ++)
+    {
+        Container numbers(resource);
+        check = check + round(numbers);
+    }
+    report(container, allocator, rounds, now() - start, check);
+}
+
+// The same, but the region gets everything back at the end of each round
+template<typename Container, typename Round>
+void run_region(const char *container, long rounds, Round round)
+{
+    dlmall::region_resource region;
+    long check = 0;
+    double start = now();
+    long r;
+    for(r = 0; r < rounds; r ++)
+    {
+        {
+            Container numbers(&region);
+            check = check + round(numbers);
+        }
+        region.release();
+    }
+    report(container, "region", rounds, now() - start, check);
+}
+
+template<typename Container, typename Round>
+void run_pool(const char *container, long rounds, Round round)
+{
+    dlmall::pool_resource pool(NODE);
+    run_pmr<Container>(container, "pool", rounds, &pool, round);
+}
+
+int main(int argc, char *argv[])
+{
+    long rounds = 20000;
+    if(argc > 1)
+    {
+        rounds = atol(argv[1]);
+    }
+    if(rounds < 1)
+    {
+        printf("usage: %s [rounds]\n", argv[0]);
+        return 1;
+    }
+    init();
+
+    auto vector_work = [](auto &numbers) { return vector_round(numbers); };
+    run<std::vector<int>>("vector", "std", rounds, vector_work);
+    run<std::vector<int, dlmall::allocator<int>>>("vector", "dlmall", rounds, vector_work);
+    run_pmr<std::pmr::vector<int>>("vector", "heap", rounds, dlmall::heap(), vector_work);
+    run_region<std::pmr::vector<int>>("vector", rounds, vector_work);
+
+    auto map_work = [](auto &numbers) { return map_round(numbers); };
+    run<std::map<int, int>>("map", "std", rounds, map_work);
+    run<std::map<int, int, std::less<int>, dlmall::allocator<std::pair<const int, int>>>>("map", "dlmall", rounds, map_work);
+    run_pmr<std::pmr::map<int, int>>("map", "heap", rounds, dlmall::heap(), map_work);
+    run_region<std::pmr::map<int, int>>("map", rounds, map_work);
+    run_pool<std::pmr::map<int, int>>("map", rounds, map_work);
+
+    run<std::unordered_map<int, int>>("unordered_map", "std", rounds, map_work);
+    run<std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, dlmall::allocator<std::pair<const int, int>>>>("unordered_map", "dlmall", rounds, map_work);
+    run_pmr<std::pmr::unordered_map<int, int>>("unordered_map", "heap", rounds, dlmall::heap(), map_work);
+    run_region<std::pmr::unordered_map<int, int>>("unordered_map", rounds, map_work);
+    run_pool<std::pmr::unordered_map<int, int>>("unordered_map", rounds, map_work);
+
+    auto list_work = [](auto &numbers) { return list_round(numbers); };
+    run<std::list<int>>("list", "std", rounds, list_work);
+    run<std::list<int, dlmall::allocator<int>>>("list", "dlmall", rounds, list_work);
+    run_pmr<std::pmr::list<int>>("list", "heap", rounds, dlmall::heap(), list_work);
+    run_region<std::pmr::list<int>>("list", rounds, list_work);
+    run_pool<std::pmr::list<int>>("list", rounds, list_work);
+
+    struct dstats stats;
+    dstats(&stats);
+    printf("at the end: %zu bytes in use, %zu free, largest free block %zu, %d blocks\n", stats.in_use, stats.free, stats.largest_free, stats.blocks);
+    return 0;
+}
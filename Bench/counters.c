@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include "dlmall.h"
+#include "counters.h"
+
+void counters_add(struct dcounters *total, struct dcounters *more)
+{
+    total->searches = total->searches + more->searches;
+    total->examined = total->examined + more->examined;
+    total->failed = total->failed + more->failed;
+    total->splits = total->splits + more->splits;
+    total->merges = total->merges + more->merges;
+    int i;
+    for(i = 0; i < CLASSES; i ++)
+    {
+        total->class_hits[i] = total->class_hits[i] + more->class_hits[i];
+        total->class_fallbacks[i] = total->class_fallbacks[i] + more->class_fallbacks[i];
+    }
+    int j;
+    for(i = 0; i < SIZE_BUCKETS; i ++)
+    {
+        for(j = 0; j < WALK_BUCKETS; j ++)
+        {
+            total->walks[i][j] = total->walks[i][j] + more->walks[i][j];
+        }
+    }
+}
+
+// Nothing is printed for an engine built without -DDALLOC_COUNTERS
+void counters_report(struct dcounters *counters)
+{
+    if(counters->searches == 0)
+    {
+        return;
+    }
+    printf("searches: %ld, %.2f blocks examined per search, %ld failed\n", counters->searches, (double) counters->examined / counters->searches, counters->failed);
+    printf("splits: %ld, merges: %ld\n", counters->splits, counters->merges);
+    int i;
+    for(i = 0; i < CLASSES; i ++)
+    {
+        if(counters->class_hits[i] != 0 || counters->class_fallbacks[i] != 0)
+        {
+            printf("class %d: %ld hits, %ld fell back to the general list\n", i + 1, counters->class_hits[i], counters->class_fallbacks[i]);
+        }
+    }
+
+    // One row per request size, labelled with its largest size, and one column
+    // per number of nodes walked, labelled with the shortest walk it holds
+    printf("nodes walked by find():\n%8s", "size");
+    int j;
+    for(j = 0; j < WALK_BUCKETS; j ++)
+    {
+        if(j < 2)
+        {
+            printf(" %8d", j);
+        }
+        else if(j < WALK_BUCKETS - 1)
+        {
+            printf(" %8d", 1 << (j - 1));
+        }
+        else
+        {
+            printf(" %7d+", 1 << (j - 1));
+        }
+    }
+    printf("\n");
+    for(i = 0; i < SIZE_BUCKETS; i ++)
+    {
+        long row = 0;
+        for(j = 0; j < WALK_BUCKETS; j ++)
+        {
+            row = row + counters->walks[i][j];
+        }
+        if(row == 0)
+        {
+            continue;
+        }
+        printf("%8d", 8 << i);
+        for(j = 0; j < WALK_BUCKETS; j ++)
+        {
+            printf(" %8ld", counters->walks[i][j]);
+        }
+        printf("\n");
+    }
+}
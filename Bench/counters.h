@@ -0,0 +1,4 @@
+// Printing of the engine's hot path counters, see dcounters() in dlmall.h
+
+void counters_add(struct dcounters *total, struct dcounters *more);
+void counters_report(struct dcounters *counters);
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+#define CACHE(cache, op, result) ((cache) | ((op) << 8) | ((result) << 16))
+
+struct counter
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+    uint64_t value;
+    double share; // of the run the counter was on the PMU for
+};
+
+struct counter counters[] =
+{
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1, 0, 0},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0, 0},
+    {"L1d misses", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1, 0, 0},
+    {"LLC misses", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1, 0, 0},
+    {"dTLB misses", PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1, 0, 0},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0, 0},
+};
+
+#define COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+// Open every counter for this process, including threads created later on,
+// and start them all together. When there are more counters than the PMU has
+// room for, the kernel takes turns with them, so each one is only counting
+// for part of the run. The kernel tells us for how long, see perf_stop().
+void perf_start()
+{
+    unsigned i;
+    for(i = 0; i < COUNTERS; i ++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        counters[i].value = 0;
+        counters[i].share = 0;
+    }
+    for(i = 0; i < COUNTERS; i ++)
+    {
+        if(counters[i].fd >= 0)
+        {
+            ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_stop()
+{
+    unsigned i;
+    for(i = 0; i < COUNTERS; i ++)
+    {
+        if(counters[i].fd >= 0)
+        {
+            ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    // A counter that was only on for part of the run is scaled up to the whole
+    // of it, so that counters which took turns can still be compared. One that
+    // never got on at all is left out.
+    for(i = 0; i < COUNTERS; i ++)
+    {
+        if(counters[i].fd >= 0)
+        {
+            uint64_t read_out[3]; // value, time enabled, time running
+            if(read(counters[i].fd, read_out, sizeof(read_out)) != sizeof(read_out) || read_out[2] == 0)
+            {
+                close(counters[i].fd);
+                counters[i].fd = -1;
+                continue;
+            }
+            counters[i].share = (double) read_out[2] / read_out[1];
+            counters[i].value = (uint64_t) (read_out[0] / counters[i].share);
+            close(counters[i].fd);
+        }
+    }
+}
+
+// Print every counter we managed to read, in total and per call
+void perf_report(long calls)
+{
+    int any = 0;
+    unsigned i;
+    for(i = 0; i < COUNTERS; i ++)
+    {
+        if(counters[i].fd < 0)
+        {
+            continue;
+        }
+        any = 1;
+        if(calls > 0)
+        {
+            printf("%s: %llu (%.2f per call)", counters[i].name, (unsigned long long) counters[i].value, (double) counters[i].value / calls);
+        }
+        else
+        {
+            printf("%s: %llu", counters[i].name, (unsigned long long) counters[i].value);
+        }
+        if(counters[i].share < 0.999)
+        {
+            printf(" scaled, counted %.0f%% of the time", 100 * counters[i].share);
+        }
+        printf("\n");
+    }
+    if(!any)
+    {
+        printf("hardware counters not available\n");
+    }
+}
@@ -0,0 +1,8 @@
+// Hardware performance counters around a benchmark run, read through
+// perf_event_open(). Counters the machine or the kernel will not give us are
+// left out of the report, so a run never fails because of them. Counters the
+// kernel had to take turns with are scaled up to the whole run.
+
+void perf_start();
+void perf_stop();
+void perf_report(long calls);
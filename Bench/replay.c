@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "dlmall.h"
+#include "trace.h"
+#include "perfctr.h"
+#include "counters.h"
+
+// Replays a trace recorded with trace.c against whichever engine this was
+// linked with, and reports how long it took, the peak footprint and the
+// fragmentation.
+
+// The footprint is the span of addresses covered by blocks, from the lowest
+// address handed out to the highest end of a block. Fragmentation compares the
+// peak footprint with the most bytes that were ever live at the same time, the
+// rest is lost to headers, alignment and holes the engine could not reuse.
+
+struct trace_record *load(const char *path, long *count)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+    {
+        printf("Could not open trace file %s\n", path);
+        return NULL;
+    }
+    struct trace_header header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC || header.version < 1 || header.version > TRACE_VERSION)
+    {
+        printf("%s is not a trace file\n", path);
+        fclose(file);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long bytes = ftell(file) - sizeof(header);
+    fseek(file, sizeof(header), SEEK_SET);
+
+    *count = bytes / sizeof(struct trace_record);
+    struct trace_record *records = malloc(*count * sizeof(struct trace_record));
+    if(records == NULL || fread(records, sizeof(struct trace_record), *count, file) != (size_t) *count)
+    {
+        printf("Could not read %s\n", path);
+        free(records);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    // Ids are handed out in order, so none can be larger than the number of
+    // records, and main() relies on that to index its tables
+    long i;
+    for(i = 0; i < *count; i ++)
+    {
+        if(header.version == 1 && records[i].size == 0)
+        {
+            records[i].size = TRACE_FREE;
+        }
+        if(records[i].id > *count || (records[i].id == 0 && records[i].size == TRACE_FREE))
+        {
+            printf("%s is not a valid trace, record %ld has id %u\n", path, i, records[i].id);
+            free(records);
+            return NULL;
+        }
+    }
+    return records;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        printf("usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    long count;
+    struct trace_record *records = load(argv[1], &count);
+    if(records == NULL)
+    {
+        return 1;
+    }
+
+    // Ids are handed out in order, so there can never be more than one per record
+    void **ptrs = calloc(count + 1, sizeof(void*));
+    uint32_t *sizes = calloc(count + 1, sizeof(uint32_t));
+
+    init();
+
+    long allocs = 0;
+    long frees = 0;
+    long failed = 0;
+    long recorded_failures = 0;
+    long live = 0;
+    long peak_live = 0;
+    char *low = NULL;
+    char *high = NULL;
+    long peak = 0;
+
+    struct timespec start, end;
+    perf_start();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long i;
+    for(i = 0; i < count; i ++)
+    {
+        struct trace_record *rec = &records[i];
+        if(rec->size != TRACE_FREE)
+        {
+            allocs ++;
+            char *memory = dalloc(rec->size);
+            if(rec->id == 0)
+            {
+                // This request failed when it was recorded, nothing will free it
+                recorded_failures ++;
+                if(memory != NULL)
+                {
+                    dfree(memory);
+                }
+                continue;
+            }
+            if(memory == NULL)
+            {
+                failed ++;
+                continue;
+            }
+            ptrs[rec->id] = memory;
+            sizes[rec->id] = rec->size;
+            live = live + rec->size;
+            if(live > peak_live)
+            {
+                peak_live = live;
+            }
+
+            if(low == NULL || memory < low)
+            {
+                low = memory;
+            }
+            if(memory + rec->size > high)
+            {
+                high = memory + rec->size;
+            }
+            if(high - low > peak)
+            {
+                peak = high - low;
+            }
+        }
+        else
+        {
+            frees ++;
+            if(ptrs[rec->id] != NULL)
+            {
+                dfree(ptrs[rec->id]);
+                live = live - sizes[rec->id];
+                ptrs[rec->id] = NULL;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    perf_stop();
+    double took = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("records: %ld (%ld dalloc, %ld dfree)\n", count, allocs, frees);
+    printf("failed: %ld (%ld already failed when recorded)\n", failed, recorded_failures);
+    printf("time: %f s\n", took);
+    printf("peak footprint: %ld bytes\n", peak);
+    printf("peak live: %ld bytes\n", peak_live);
+    if(peak > 0)
+    {
+        printf("fragmentation: %.1f%%\n", 100.0 * (peak - peak_live) / peak);
+    }
+    struct dstats stats;
+    dstats(&stats);
+    printf("at the end: %zu bytes in use, %zu free, largest free block %zu, %d blocks, free list length %d\n", stats.in_use, stats.free, stats.largest_free, stats.blocks, stats.lengths[0]);
+    struct dcounters counters;
+    dcounters(&counters);
+    counters_report(&counters);
+    perf_report(count);
+
+    free(ptrs);
+    free(sizes);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,417 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "dlmall.h"
+#include "perfctr.h"
+#include "counters.h"
+
+// Well known allocator stress patterns, run against whichever engine this was
+// linked with. Every workload prints one line in the same format so that runs
+// can be compared:
+//
+//     <workload> threads: <n> ops: <n> ops/s: <n> failed: <n> rss: <kbytes>
+//
+// followed by the engine's hot path counters, when it was built with them, and
+// the hardware counters for the run, per dalloc/dfree.
+//
+// The engines keep a single arena and are not thread safe, so all calls are
+// serialised through one lock. The multi-threaded workloads still show how an
+// engine copes with memory being freed by a different thread than the one that
+// allocated it, and with neighbouring blocks being written from different cores.
+
+#define MAX_THREADS 64
+
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *lock_dalloc(size_t request)
+{
+    pthread_mutex_lock(&lock);
+    void *memory = dalloc(request);
+    pthread_mutex_unlock(&lock);
+    return memory;
+}
+
+void lock_dfree(void *memory)
+{
+    pthread_mutex_lock(&lock);
+    dfree(memory);
+    pthread_mutex_unlock(&lock);
+}
+
+double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+long rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Small private generator, rand() takes a lock of its own
+unsigned next_random(unsigned *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+struct worker
+{
+    pthread_t thread;
+    void *(*body)(void*);
+    int id;
+    int threads;
+    double seconds;
+    long ops;
+    long failed;
+    struct dcounters counters;
+};
+
+// The engine counts per thread, so each worker picks up its own counters
+// before it goes away
+void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    w->body(w);
+    dcounters(&w->counters);
+    return NULL;
+}
+
+void report(const char *name, struct worker *workers, int threads, double took)
+{
+    long ops = 0;
+    long failed = 0;
+    struct dcounters counters;
+    memset(&counters, 0, sizeof(counters));
+    int i;
+    for(i = 0; i < threads; i ++)
+    {
+        ops = ops + workers[i].ops;
+        failed = failed + workers[i].failed;
+        counters_add(&counters, &workers[i].counters);
+    }
+    printf("%s threads: %d ops: %ld ops/s: %.0f failed: %ld rss: %ld\n", name, threads, ops, ops / took, failed, rss());
+    counters_report(&counters);
+    perf_report(ops);
+}
+
+double run(void *(*body)(void*), struct worker *workers, int threads, double seconds)
+{
+    int i;
+    for(i = 0; i < threads; i ++)
+    {
+        workers[i].body = body;
+        workers[i].id = i;
+        workers[i].threads = threads;
+        workers[i].seconds = seconds;
+        workers[i].ops = 0;
+        workers[i].failed = 0;
+    }
+    perf_start();
+    double start = now();
+    for(i = 0; i < threads; i ++)
+    {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    for(i = 0; i < threads; i ++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double took = now() - start;
+    perf_stop();
+    return took;
+}
+
+// Larson: a server where every thread keeps a set of live objects and keeps
+// replacing a random one with a new object of random size. Each round the
+// slots are handed on to the next thread, so most frees hit blocks that were
+// allocated by someone else.
+#define LARSON_SLOTS 64
+#define LARSON_MIN 8
+#define LARSON_MAX 128
+#define LARSON_ROUND 10000
+
+void *larson_slots[MAX_THREADS][LARSON_SLOTS];
+pthread_barrier_t larson_barrier;
+volatile int larson_last = -1; // the round after which everyone stops
+
+void *larson(void *arg)
+{
+    struct worker *w = arg;
+    unsigned seed = w->id + 1;
+    double end = now() + w->seconds;
+    int round = 0;
+    while(larson_last < 0 || round <= larson_last)
+    {
+        void **slots = larson_slots[(w->id + round) % w->threads];
+        int i;
+        for(i = 0; i < LARSON_ROUND; i ++)
+        {
+            int k = next_random(&seed) % LARSON_SLOTS;
+            if(slots[k] != NULL)
+            {
+                lock_dfree(slots[k]);
+            }
+            int size = LARSON_MIN + next_random(&seed) % (LARSON_MAX - LARSON_MIN + 1);
+            slots[k] = lock_dalloc(size);
+            if(slots[k] == NULL)
+            {
+                w->failed ++;
+            }
+            w->ops = w->ops + 2;
+        }
+        // Naming the last round, rather than raising a flag, keeps a thread
+        // which is slow to leave the barrier from stopping a round early
+        if(w->id == 0 && larson_last < 0 && now() > end)
+        {
+            larson_last = round + 1;
+        }
+        round ++;
+        pthread_barrier_wait(&larson_barrier);
+    }
+    return NULL;
+}
+
+// xmalloc: half of the threads only allocate and the other half only free,
+// objects travel from a producer to its consumer through a ring.
+#define RING 256
+
+struct ring
+{
+    void *items[RING];
+    volatile unsigned head; // written by the producer
+    volatile unsigned tail; // written by the consumer
+    volatile int done;
+};
+
+struct ring rings[MAX_THREADS];
+
+void *xmalloc(void *arg)
+{
+    struct worker *w = arg;
+    struct ring *r = &rings[w->id / 2];
+    unsigned seed = w->id + 1;
+    if(w->id % 2 == 0)
+    {
+        double end = now() + w->seconds;
+        while(now() < end)
+        {
+            int n;
+            for(n = 0; n < 1000; n ++)
+            {
+                while(r->head - r->tail == RING)
+                {
+                    sched_yield();
+                }
+                void *memory = lock_dalloc(8 + next_random(&seed) % 120);
+                if(memory == NULL)
+                {
+                    w->failed ++;
+                    continue;
+                }
+                r->items[r->head % RING] = memory;
+                __sync_synchronize();
+                r->head ++;
+                w->ops ++;
+            }
+        }
+        r->done = 1;
+    }
+    else
+    {
+        while(!r->done || r->tail != r->head)
+        {
+            if(r->tail == r->head)
+            {
+                sched_yield();
+                continue;
+            }
+            __sync_synchronize();
+            lock_dfree(r->items[r->tail % RING]);
+            r->tail ++;
+            w->ops ++;
+        }
+    }
+    return NULL;
+}
+
+// cache-thrash: every thread allocates a small object, writes to it over and
+// over, and frees it again. An engine which hands neighbouring blocks to
+// different threads makes the cores fight over the same cache line.
+//
+// This and cache-scratch do not measure false sharing on its own. The writes
+// happen outside the lock, but every dalloc() and dfree() goes through the one
+// lock above, so the threads also wait for each other there, and the time is
+// as much lock contention as cache line traffic. Compare engines at the same
+// number of threads rather than reading the numbers as false sharing costs.
+// More writes per object, see THRASH_WRITES, weigh the cache lines more.
+#define THRASH_SIZE 8
+#define THRASH_WRITES 1000
+
+void *thrash(void *arg)
+{
+    struct worker *w = arg;
+    double end = now() + w->seconds;
+    while(now() < end)
+    {
+        int n;
+        for(n = 0; n < 100; n ++)
+        {
+            volatile char *memory = lock_dalloc(THRASH_SIZE);
+            if(memory == NULL)
+            {
+                w->failed ++;
+                continue;
+            }
+            int i;
+            for(i = 0; i < THRASH_WRITES; i ++)
+            {
+                memory[i % THRASH_SIZE] ++;
+            }
+            lock_dfree((void*) memory);
+            w->ops = w->ops + 2;
+        }
+    }
+    return NULL;
+}
+
+// cache-scratch: the main thread allocates one small object per thread, so
+// they end up next to each other, and each thread frees the one it was given
+// before doing the same work as cache-thrash. An engine which hands the freed
+// block straight back keeps the threads writing to a shared cache line. The
+// lock weighs in as it does for cache-thrash.
+void *scratch_given[MAX_THREADS];
+
+void *scratch(void *arg)
+{
+    struct worker *w = arg;
+    lock_dfree(scratch_given[w->id]);
+    return thrash(arg);
+}
+
+// Fragmentation soak: one thread runs for a long time through phases which
+// change the size mix, keeping a large and shifting set of objects alive. This
+// is where an engine that cannot put its free space back together runs dry.
+#define SOAK_SLOTS 512
+
+void *soak(void *arg)
+{
+    struct worker *w = arg;
+    void *slots[SOAK_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    unsigned seed = 1;
+    double start = now();
+    double end = start + w->seconds;
+    while(now() < end)
+    {
+        // A new phase every tenth of the run: small, medium or mixed objects
+        int phase = (int) ((now() - start) * 10 / w->seconds) % 3;
+        int n;
+        for(n = 0; n < 1000; n ++)
+        {
+            int k = next_random(&seed) % SOAK_SLOTS;
+            if(slots[k] != NULL)
+            {
+                dfree(slots[k]);
+                slots[k] = NULL;
+                w->ops ++;
+                continue;
+            }
+            int size;
+            if(phase == 0)
+            {
+                size = 8 + next_random(&seed) % 56;
+            }
+            else if(phase == 1)
+            {
+                size = 128 + next_random(&seed) % 896;
+            }
+            else
+            {
+                size = 8 + next_random(&seed) % 2040;
+            }
+            slots[k] = dalloc(size);
+            if(slots[k] == NULL)
+            {
+                w->failed ++;
+            }
+            w->ops ++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: %s larson|xmalloc|cache-thrash|cache-scratch|soak [threads] [seconds]\n", argv[0]);
+        return 1;
+    }
+    char *name = argv[1];
+    int threads = 4;
+    double seconds = 5;
+    if(argc > 2)
+    {
+        threads = atoi(argv[2]);
+    }
+    if(argc > 3)
+    {
+        seconds = atof(argv[3]);
+    }
+    if(threads < 1 || threads > MAX_THREADS)
+    {
+        printf("threads must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    init();
+
+    struct worker workers[MAX_THREADS];
+    double took;
+    if(strcmp(name, "larson") == 0)
+    {
+        pthread_barrier_init(&larson_barrier, NULL, threads);
+        took = run(larson, workers, threads, seconds);
+    }
+    else if(strcmp(name, "xmalloc") == 0)
+    {
+        // Producers and consumers come in pairs
+        threads = threads + threads % 2;
+        took = run(xmalloc, workers, threads, seconds);
+    }
+    else if(strcmp(name, "cache-thrash") == 0)
+    {
+        took = run(thrash, workers, threads, seconds);
+    }
+    else if(strcmp(name, "cache-scratch") == 0)
+    {
+        int i;
+        for(i = 0; i < threads; i ++)
+        {
+            scratch_given[i] = dalloc(THRASH_SIZE);
+        }
+        took = run(scratch, workers, threads, seconds);
+    }
+    else if(strcmp(name, "soak") == 0)
+    {
+        threads = 1;
+        took = run(soak, workers, threads, seconds);
+    }
+    else
+    {
+        printf("Unknown workload %s\n", name);
+        return 1;
+    }
+
+    report(name, workers, threads, took);
+    return 0;
+}
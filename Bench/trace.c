@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "dlmall.h"
+#include "trace.h"
+
+// The tracer itself has to call the real engine
+#undef dalloc
+#undef dfree
+
+#define TRUE 1
+#define FALSE 0
+
+// The tracer needs to map a pointer back to the id it was given when it was
+// allocated. This is a fixed size open addressing table, which is plenty for
+// the number of blocks that can be live in an arena at the same time. It is
+// never let fill up past FULL, where probing gets long, and with no empty slot
+// at all it would never end: a program with more blocks live than that stops
+// being traced, and says so.
+#define SLOTS (1 << 16)
+#define FULL (SLOTS / 4 * 3)
+
+struct slot
+{
+    void *memory;
+    uint32_t id;
+};
+
+struct slot slots[SLOTS];
+
+FILE *trace_file = NULL;
+uint32_t next_id = 1;
+int live = 0;
+
+// Threads are traced one call at a time, so that the ids, the table and the
+// records in the file agree with each other
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+struct timespec started;
+int tried_env = FALSE;
+
+int hash(void *memory)
+{
+    uintptr_t p = (uintptr_t) memory;
+    return (int) (((p >> 3) * 2654435761u) & (SLOTS - 1));
+}
+
+void remember(void *memory, uint32_t id)
+{
+    int i = hash(memory);
+    while(slots[i].memory != NULL)
+    {
+        i = (i + 1) & (SLOTS - 1);
+    }
+    slots[i].memory = memory;
+    slots[i].id = id;
+    live ++;
+}
+
+uint32_t forget(void *memory)
+{
+    int i = hash(memory);
+    while(slots[i].memory != memory)
+    {
+        if(slots[i].memory == NULL)
+        {
+            // Not something we handed out while tracing
+            return 0;
+        }
+        i = (i + 1) & (SLOTS - 1);
+    }
+    uint32_t id = slots[i].id;
+    slots[i].memory = NULL;
+    live --;
+
+    // Shift the rest of the run back so that lookups never stop early
+    int j = (i + 1) & (SLOTS - 1);
+    while(slots[j].memory != NULL)
+    {
+        int home = hash(slots[j].memory);
+        if(((j - home) & (SLOTS - 1)) >= ((j - i) & (SLOTS - 1)))
+        {
+            slots[i] = slots[j];
+            slots[j].memory = NULL;
+            i = j;
+        }
+        j = (j + 1) & (SLOTS - 1);
+    }
+    return id;
+}
+
+uint64_t elapsed()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - started.tv_sec) * 1000000000 + (now.tv_nsec - started.tv_nsec);
+}
+
+void record(uint32_t id, uint32_t size)
+{
+    struct trace_record rec;
+    rec.id = id;
+    rec.size = size;
+    rec.time = elapsed();
+    fwrite(&rec, sizeof(rec), 1, trace_file);
+}
+
+int trace_start(const char *path)
+{
+    if(trace_file != NULL)
+    {
+        trace_stop();
+    }
+    trace_file = fopen(path, "wb");
+    if(trace_file == NULL)
+    {
+        printf("Could not open trace file %s\n", path);
+        return FALSE;
+    }
+    // Ids start over with every trace, and nothing from an earlier one is live
+    next_id = 1;
+    live = 0;
+    memset(slots, 0, sizeof(slots));
+    struct trace_header header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    fwrite(&header, sizeof(header), 1, trace_file);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    return TRUE;
+}
+
+void trace_stop()
+{
+    if(trace_file != NULL)
+    {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+// Start tracing from the environment the first time we are called
+int tracing()
+{
+    if(trace_file == NULL && !tried_env)
+    {
+        tried_env = TRUE;
+        char *path = getenv("DALLOC_TRACE");
+        if(path != NULL && trace_start(path))
+        {
+            atexit(trace_stop);
+        }
+    }
+    return trace_file != NULL;
+}
+
+void *trace_dalloc(size_t request)
+{
+    void *memory = dalloc(request);
+    pthread_mutex_lock(&trace_lock);
+    if(tracing())
+    {
+        uint32_t id = 0;
+        if(memory != NULL && live == FULL)
+        {
+            printf("More than %d blocks live, the trace stops here\n", FULL);
+            trace_stop();
+        }
+        else
+        {
+            if(memory != NULL)
+            {
+                id = next_id;
+                next_id ++;
+                remember(memory, id);
+            }
+            record(id, request > TRACE_MAX ? TRACE_MAX : (uint32_t) request);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return memory;
+}
+
+void trace_dfree(void *memory)
+{
+    pthread_mutex_lock(&trace_lock);
+    if(memory != NULL && tracing())
+    {
+        uint32_t id = forget(memory);
+        if(id != 0)
+        {
+            record(id, TRACE_FREE);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    dfree(memory);
+}
@@ -0,0 +1,45 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation tracing. Every dalloc() and dfree() is written to a binary trace
+// file, which replay can later feed to any of the engines.
+
+// A trace is a small file header followed by one fixed size record per call.
+// Allocations are given an id in the order they are made (starting at 1), and
+// a dfree() refers to the allocation by that id, so the trace does not depend
+// on the addresses handed out by the engine it was recorded with.
+// An allocation that failed is recorded with id 0.
+// A dfree() is recorded with size TRACE_FREE, so that it cannot be mistaken
+// for a dalloc(0). Version 1 traces used size 0 for a dfree, the loaders in
+// replay.c and classes.c turn those into TRACE_FREE.
+// Requests too large for the size field are recorded as TRACE_MAX.
+#define TRACE_MAGIC 0x43525444 // "DTRC"
+#define TRACE_VERSION 2
+#define TRACE_FREE 0xffffffff
+#define TRACE_MAX (TRACE_FREE - 1)
+
+struct trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct trace_record
+{
+    uint32_t id; // 4 bytes, the pointer id
+    uint32_t size; // 4 bytes, bytes requested, TRACE_FREE for a dfree
+    uint64_t time; // 8 bytes, nanoseconds since the trace was started
+};
+
+int trace_start(const char *path);
+void trace_stop();
+void *trace_dalloc(size_t request);
+void trace_dfree(void *memory);
+
+// Compiling a program with -DDALLOC_TRACE and including this header after
+// dlmall.h sends all of its calls through the tracer. The trace file is taken
+// from the DALLOC_TRACE environment variable unless trace_start() was called.
+#ifdef DALLOC_TRACE
+#define dalloc(request) trace_dalloc(request)
+#define dfree(memory) trace_dfree(memory)
+#endif
@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "dlmall.h"
+
+// A binary buddy engine. The arena is split in halves, quarters and so on,
+// and every block is a power of two in size and starts at a multiple of its
+// size within the arena. That makes the block it was split from, its buddy,
+// a matter of flipping one bit of its offset, so freeing a block can find out
+// whether it can be merged without looking at any list.
+
+// HEAD is the size of the header in front of every block
+
+// ORDER() is the size of a block of the given order, a block of order 5 is
+// 32 bytes. MIN_ORDER is the smallest block we make, room for a header and at
+// least 8 bytes, and MAX_ORDER is the whole arena.
+
+// MACIC() and HIDE() are used as a way of hiding and retrieving the header
+
+// ARENA is a large block which we allocate at the beginning, i.e the whole 64 kbyte heap.
+// RELATIVE_LINKS keeps the free list links in a header as 32 bit offsets from
+// the start of the arena instead of pointers, see block_at(). It can be turned off
+// with -DRELATIVE_LINKS=0
+
+#define TRUE 1
+#define FALSE 0
+#define HEAD (sizeof(struct head))
+#define ORDER(order) (1 << (order))
+#define MIN_ORDER 5
+#define MAX_ORDER 16
+#define MAGIC(memory) ((struct head*) memory - 1)
+#define HIDE(block) (void*)((struct head*) block + 1)
+#define ARENA (64*1024)
+
+#ifndef RELATIVE_LINKS
+#define RELATIVE_LINKS TRUE
+#endif
+
+// NEXT() and PREV() follow the free list links of a block and SET_NEXT() and
+// SET_PREV() change them, whichever way they are kept
+#if RELATIVE_LINKS
+#define NONE 0xffffffff
+#define NEXT(block) (block_at((block)->next))
+#define PREV(block) (block_at((block)->prev))
+#define SET_NEXT(block, to) ((block)->next = offset_of(to))
+#define SET_PREV(block, to) ((block)->prev = offset_of(to))
+#else
+#define NEXT(block) ((block)->next)
+#define PREV(block) ((block)->prev)
+#define SET_NEXT(block, to) ((block)->next = (to))
+#define SET_PREV(block, to) ((block)->prev = (to))
+#endif
+
+// Implementation of a block header
+// The block header must be aligned to a multiple of 8 bytes
+// The size of a block follows from its order, so only that is kept.
+// Currently, the header size is 16 bytes, as in the other engines, or 24 bytes
+// with -DRELATIVE_LINKS=0.
+struct head
+{
+    uint16_t free; // 2 bytes, the status of this block
+    uint16_t order; // 2 bytes, the block is ORDER(order) bytes, header included
+#if RELATIVE_LINKS
+    uint32_t spare; // 4 bytes, keeps the header a multiple of 8 bytes
+    uint32_t next; // 4 bytes, offset of the next block on the free list
+    uint32_t prev; // 4 bytes, offset of the previous block on the free list
+#else
+    struct head *next; // 8 bytes, pointer for free list
+    struct head *prev; // 8 bytes, pointer for free list
+#endif
+};
+
+// Creating new blocks can be done with mmap(). This process will allocate
+// Memory for our process.
+struct head *arena = NULL;
+
+#if RELATIVE_LINKS
+// A free list link is the offset of a block from the start of the arena, which
+// takes 4 bytes instead of 8 and makes the header 16 bytes. NONE is the end of
+// a list, since offset 0 is the first block of the arena.
+struct head *block_at(uint32_t offset)
+{
+    if(offset == NONE)
+    {
+        return NULL;
+    }
+    return (struct head*) ((char*) arena + offset);
+}
+
+uint32_t offset_of(struct head *block)
+{
+    if(block == NULL)
+    {
+        return NONE;
+    }
+    return (uint32_t) ((char*) block - (char*) arena);
+}
+#endif
+
+// One free list per order. nonempty has bit k set while the list of order k
+// has something on it, which lets dalloc() go straight to the smallest order
+// that can serve a request.
+struct head *flists[MAX_ORDER + 1];
+uint32_t nonempty = 0;
+
+// One bit per block of each order, set while that block is free. A block of
+// order k is bit (offset >> k) of bitmap[k].
+uint8_t bitmap[MAX_ORDER + 1][ARENA >> MIN_ORDER >> 3];
+
+// Running totals behind dstats(), kept up to date in insert() and detach()
+int free_bytes = 0;
+int free_length = 0;
+int free_lengths[MAX_ORDER + 1];
+int blocks = 0;
+
+// Hot path counters, see dcounters(). They compile to nothing unless the
+// engine is built with -DDALLOC_COUNTERS.
+#ifdef DALLOC_COUNTERS
+__thread struct dcounters hot;
+#define COUNT(field) (hot.field ++)
+#define WALKED(size, n) (hot.examined += (n), hot.walks[size_bucket(size)][walk_bucket(n)] ++)
+#else
+#define COUNT(field)
+#define WALKED(size, n) ((void) (n))
+#endif
+
+// Histogram buckets, see SIZE_BUCKETS and WALK_BUCKETS
+int size_bucket(int size)
+{
+    int i = 0;
+    while(i < SIZE_BUCKETS - 1 && size > (8 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+int walk_bucket(int walked)
+{
+    int i = 0;
+    while(i < WALK_BUCKETS - 1 && walked >= (1 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+int offset(struct head *block)
+{
+    return (char*) block - (char*) arena;
+}
+
+// The block this one was split from, or will be merged with
+struct head *buddy(struct head *block, int order)
+{
+    return (struct head*) ((char*) arena + (offset(block) ^ ORDER(order)));
+}
+
+int is_free(struct head *block, int order)
+{
+    int bit = offset(block) >> order;
+    return (bitmap[order][bit / 8] >> (bit % 8)) & 1;
+}
+
+void mark(struct head *block, int order, int free)
+{
+    int bit = offset(block) >> order;
+    if(free)
+    {
+        bitmap[order][bit / 8] |= 1 << (bit % 8);
+    }
+    else
+    {
+        bitmap[order][bit / 8] &= ~(1 << (bit % 8));
+    }
+}
+
+// Used for detaching from the free list (not the same as allocating memory)
+void detach(struct head *block)
+{
+    int order = block->order;
+    if(NEXT(block) != NULL)
+    {
+        SET_PREV(NEXT(block), PREV(block));
+    }
+    if(PREV(block) != NULL)
+    {
+        SET_NEXT(PREV(block), NEXT(block));
+    }
+    else
+    {
+        flists[order] = NEXT(block);
+    }
+    if(flists[order] == NULL)
+    {
+        nonempty &= ~(1u << order);
+    }
+    mark(block, order, FALSE);
+    free_bytes = free_bytes - (ORDER(order) - HEAD);
+    free_length --;
+    free_lengths[order] --;
+}
+
+// Used for inserting to free list (not the same as freeing memory)
+void insert(struct head *block)
+{
+    int order = block->order;
+    block->free = TRUE;
+    SET_PREV(block, NULL);
+    SET_NEXT(block, flists[order]);
+    if(flists[order] != NULL)
+    {
+        SET_PREV(flists[order], block);
+    }
+    flists[order] = block;
+    nonempty |= 1u << order;
+    mark(block, order, TRUE);
+    free_bytes = free_bytes + (ORDER(order) - HEAD);
+    free_length ++;
+    free_lengths[order] ++;
+}
+
+void *new()
+{
+    if(arena != NULL)
+    {
+        printf("One arena already allocated\n");
+        return NULL;
+    }
+    // Using mmap, but we could have also used sbrk
+    struct head *new = mmap(NULL, ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(new == MAP_FAILED)
+    {
+        printf("mmap failed");
+        return NULL;
+    }
+    arena = new;
+
+    // The whole arena starts out as one free block, there is no sentinel
+    // since blocks never need to find the one after them
+    new->order = MAX_ORDER;
+    insert(new);
+    blocks = 1;
+    return new;
+}
+
+// The smallest order with room for the request and a header
+int order_of(size_t request)
+{
+    int order = MIN_ORDER;
+    while(order <= MAX_ORDER && (size_t) ORDER(order) < request + HEAD)
+    {
+        order ++;
+    }
+    return order;
+}
+
+void *dalloc(size_t request)
+{
+    if (request <= 0)
+    {
+        printf("Invalid Dalloc Request");
+        return NULL;
+    }
+    int order = order_of(request);
+    COUNT(searches);
+    if(order > MAX_ORDER)
+    {
+        WALKED(request, 0);
+        COUNT(failed);
+        return NULL;
+    }
+
+    // The smallest order at or above the one we want with a free block
+    uint32_t fits = nonempty & ~(ORDER(order) - 1);
+    if(fits == 0)
+    {
+        WALKED(request, 0);
+        COUNT(failed);
+        return NULL;
+    }
+    int found = __builtin_ctz(fits);
+    WALKED(request, found - order);
+
+    struct head *block = flists[found];
+    detach(block);
+
+    // Halve it until it is the right size, the upper halves go on the free lists
+    while(found > order)
+    {
+        found --;
+        block->order = found;
+        struct head *upper = buddy(block, found);
+        upper->order = found;
+        insert(upper);
+        blocks ++;
+        COUNT(splits);
+    }
+    block->free = FALSE;
+    return HIDE(block);
+}
+
+// Merges the block with its buddy for as long as the buddy is free and has
+// not been split, then puts what is left on the free list
+void dfree(void *memory)
+{
+    if(memory != NULL)
+    {
+        struct head *block = (struct head*) MAGIC(memory);
+        int order = block->order;
+        while(order < MAX_ORDER)
+        {
+            struct head *bud = buddy(block, order);
+            if(!is_free(bud, order))
+            {
+                break;
+            }
+            detach(bud);
+            if(bud < block)
+            {
+                block = bud;
+            }
+            order ++;
+            block->order = order;
+            blocks --;
+            COUNT(merges);
+        }
+        insert(block);
+    }
+    return;
+}
+
+// Checks that the free lists are ok
+void sanity()
+{
+    int length;
+    int acc_size;
+    acc_size = 0;
+    length = 0;
+    int order;
+    for(order = MIN_ORDER; order <= MAX_ORDER; order ++)
+    {
+        struct head* current = flists[order];
+        while(current != NULL)
+        {
+            printf("I am: %p\n", current);
+            printf("flist node free? expected result 1: %d\n", current->free);
+            printf("flist node has the order of its list? expected result 1: %d\n", current->order == order);
+            printf("flist node is aligned to its size? expected result 0: %d\n", offset(current) % ORDER(order));
+            printf("node prev: %p\n", PREV(current));
+            printf("node next: %p\n", NEXT(current));
+            printf("My size is %d\n", ORDER(order));
+            printf("\n");
+            acc_size = acc_size + ORDER(order);
+            current = NEXT(current);
+            length ++;
+        }
+    }
+    printf("Length of the free lists: %d\n", length);
+    printf("Total size of free list nodes: %d\n", acc_size);
+    if(length > 0)
+    {
+        printf("Average size of free list nodes: %d\n", acc_size / length);
+    }
+}
+
+void traverse()
+{
+    struct head* current = arena;
+    char * end = (char*)arena + ARENA;
+    while((char*)current < end)
+    {
+        printf("I am: %p\n", current);
+        printf("memory node free? 1 is free, 0 is not free: %d\n", current->free);
+        printf("My memory size is : %d\n", ORDER(current->order));
+        printf("My buddy is : %p\n", buddy(current, current->order));
+        printf("next in memory: %p\n", (char*) current + ORDER(current->order));
+        printf("\n");
+        current = (struct head*) ((char*) current + ORDER(current->order));
+    }
+}
+
+int initiated = FALSE;
+void init()
+{
+    if (!initiated)
+    {
+        initiated = TRUE;
+        new();
+    }
+}
+
+void dstats(struct dstats *out)
+{
+    memset(out, 0, sizeof(struct dstats));
+    out->free = free_bytes;
+    out->overhead = blocks * HEAD;
+    out->in_use = ARENA - out->overhead - out->free;
+    if(nonempty != 0)
+    {
+        out->largest_free = ORDER(31 - __builtin_clz(nonempty)) - HEAD;
+    }
+    out->blocks = blocks;
+    out->lengths[0] = free_length;
+    int order;
+    for(order = MIN_ORDER; order <= MAX_ORDER; order ++)
+    {
+        out->lengths[order - MIN_ORDER + 1] = free_lengths[order];
+        // The free blocks of an order are all the same size, a header less
+        // than the order, so only 16, 48 and 112 bytes have any
+        int size = ORDER(order) - HEAD;
+        if(size / 8 <= CLASSES)
+        {
+            out->class_free[size / 8 - 1] = free_lengths[order];
+        }
+    }
+}
+
+void dcounters(struct dcounters *out)
+{
+#ifdef DALLOC_COUNTERS
+    *out = hot;
+#else
+    memset(out, 0, sizeof(struct dcounters));
+#endif
+}
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "dlmall.h"
+
+#define REQ_UPPER 5 // upper number of dalloc requests/frees at once
+#define REQ_LOWER 1 // lower number of dalloc requests/frees at once
+
+void test1(int upper)
+{
+    // first request will always work
+    srand(time(NULL));
+    int i = 1;
+    int randomnumber;
+    randomnumber = (rand() % upper) + 1;
+
+    struct head *alloc = dalloc(randomnumber);
+    printf("%d SUCCESS: %d bytes allocated. %p\n",i, randomnumber, alloc);
+    i++;
+    while(alloc != NULL)
+    {
+        randomnumber = (rand() % upper) + 1;
+        alloc = dalloc(randomnumber);
+        if(alloc != NULL)
+        {
+            printf("%d SUCCESS: %d bytes allocated. %p\n",i, randomnumber, alloc);
+            i++;
+        }
+        else
+        {
+            printf("%d FAILURE\n", i);
+            i++;
+        }
+    }
+}
+
+void test2(volatile int loops, int av)
+{
+    // let's use 100 indices
+    struct head* procs[100]; 
+    int i;
+    for (i = 0; i < 100; i ++)
+    {
+        procs[i] = NULL;
+    }
+
+    int j = 0;
+
+    srand(time(NULL));
+    while(loops > 0)
+    { 
+        int randomnumber;
+        //printf("%d ", loops);
+        randomnumber = (rand() % 100);
+
+        if(procs[randomnumber] == NULL)
+        {
+            
+            int randalloc;
+            randalloc = (rand() % av) + 1;
+            struct head *temp = dalloc(randalloc);
+            if(temp == NULL)
+            {
+                //printf("MALLOC FAILED");
+                j ++;
+            }
+            else
+            {
+                procs[randomnumber] = temp;
+            }
+        }
+        else
+        {
+            struct head *temp = procs[randomnumber];
+            if(temp != NULL)
+            {
+                dfree(temp);
+            }
+            procs[randomnumber] = NULL;
+        }
+        loops --;
+    }
+
+    printf("I failed this much: %d. ", j);
+
+    //sanity();
+    
+
+}
+
+// Fills the arena with blocks of random sizes and frees them all again, in
+// a random order. Every block should find its buddy on the way back, leaving
+// the arena as the one free block of MAX_ORDER it started out as.
+void test3()
+{
+    struct head *procs[1000];
+    int n = 0;
+    srand(time(NULL));
+    while(n < 1000)
+    {
+        struct head *temp = dalloc((rand() % 1000) + 1);
+        if(temp == NULL)
+        {
+            break;
+        }
+        procs[n] = temp;
+        n ++;
+    }
+
+    int i;
+    for(i = n - 1; i > 0; i --)
+    {
+        int j = rand() % (i + 1);
+        struct head *temp = procs[i];
+        procs[i] = procs[j];
+        procs[j] = temp;
+    }
+    for(i = 0; i < n; i ++)
+    {
+        dfree(procs[i]);
+    }
+
+    struct dstats stats;
+    dstats(&stats);
+    if(stats.in_use == 0 && stats.blocks == 1 && stats.lengths[0] == 1)
+    {
+        printf("Freed %d blocks and they all merged again. ", n);
+    }
+    else
+    {
+        printf("FAILED: %d blocks freed but %d blocks left, %d of them free. ", n, stats.blocks, stats.lengths[0]);
+    }
+}
+
+int main()
+{
+    // Initialise our program memory
+    init();
+
+    test3();
+
+    // Perform tests as appropriate, e.g.
+    clock_t start, end;
+    double cpu_time_used;
+
+    start = clock();
+    test2(100000000,100);
+    end = clock();
+    cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
+
+    printf("I took: %f", cpu_time_used);
+
+    return 0;
+}
\ No newline at end of file
@@ -2,45 +2,132 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
+#include "dlmall.h"
 
 // Some definitions for future use:
 // HEAD is important, as we can reference the size of a header easily
 
 // MIN() is the minimum size that we will hand out. The minimum size, apart
-// from the header, that a block will consist of. Currently, it is set to 8 bytes
+// from the header, that a block will consist of. Currently, it is set to 8 bytes,
+// see min_size
 
 // LIMIT() is the size that a block has to be larger than in order to split it.
 // For example, if we want to split a block to accommodate 32 bytes, the block must
-// be LIMIT(32) = 8 + 24 + 32
+// be LIMIT(32) = 8 + 16 + 32, where the 8 is split_min
 
 // MACIC() and HIDE() are used as a way of hiding and retrieving the header
 
 // ALIGN reminds us that memory which is returned needs to be aligned with 8 bytes, on a 64 bit architecture
 
 // ARENA is a large block which we allocate at the beginning, i.e the whole 64 kbyte heap.
+
+// RESERVE is how much of the arena real-time mode sets aside for when a search is cut short
+
+// CARVE_FRONT decides which end of a free block is handed out when it is split,
+// see carve(). It can be changed when building with -DCARVE_FRONT=1
+
+// ADDRESS_ORDER keeps the free lists sorted by address instead of putting freed
+// blocks at the head, see insert(). It can be turned on with -DADDRESS_ORDER=1
+
+// SLAB is the size of the slabs small objects are packed into without headers,
+// and SLAB_MAX the largest object that goes in one. HEADERLESS turns them on,
+// see slab_alloc(). They can be turned off with -DHEADERLESS=0
+
+// REGION_CHUNK is how much a region takes from the heap at a time, see dregion_create()
+
+// CACHE_LINE is the size of a cache line. SLAB_COLORING staggers where the
+// objects of successive slabs start, see new_slab(), and can be turned off with
+// -DSLAB_COLORING=0. THREAD_LINES gives every thread slabs of its own, see
+// slab_alloc(), and can be turned on with -DTHREAD_LINES=1
+
+// RELATIVE_LINKS keeps the free list links in a header as 32 bit offsets from
+// the start of the arena instead of pointers, see block_at(). It can be turned off
+// with -DRELATIVE_LINKS=0
+
+// Most of these can also be changed when the program starts, see configure()
 #define TRUE 1
 #define FALSE 0
 #define HEAD (sizeof(struct head))
-#define MIN(size) (((size)>(8))?(size):(8))
-#define LIMIT(size) (MIN(0) + HEAD + size)
+#define MIN(size) (((size)>(min_size))?(size):(min_size))
+#define LIMIT(size) (split_min + HEAD + size)
 #define MAGIC(memory) ((struct head*) memory - 1)
 #define HIDE(block) (void*)((struct head*) block + 1)
 #define ALIGN 8
 #define ARENA (64*1024)
+#define RESERVE 4096
+#define SLAB 512
+#define SLAB_MAX 64
+#define REGION_CHUNK 2048
+#define CACHE_LINE 64
+
+#ifndef CARVE_FRONT
+#define CARVE_FRONT FALSE
+#endif
+
+#ifndef ADDRESS_ORDER
+#define ADDRESS_ORDER FALSE
+#endif
+
+#ifndef HEADERLESS
+#define HEADERLESS TRUE
+#endif
+
+#ifndef SLAB_COLORING
+#define SLAB_COLORING TRUE
+#endif
+
+#ifndef THREAD_LINES
+#define THREAD_LINES FALSE
+#endif
+
+#ifndef RELATIVE_LINKS
+#define RELATIVE_LINKS TRUE
+#endif
+
+// NEXT() and PREV() follow the free list links of a block and SET_NEXT() and
+// SET_PREV() change them, whichever way they are kept
+#if RELATIVE_LINKS
+#define NONE 0xffffffff
+#define NEXT(block) (block_at((block)->next))
+#define PREV(block) (block_at((block)->prev))
+#define SET_NEXT(block, to) ((block)->next = offset_of(to))
+#define SET_PREV(block, to) ((block)->prev = offset_of(to))
+#else
+#define NEXT(block) ((block)->next)
+#define PREV(block) ((block)->prev)
+#define SET_NEXT(block, to) ((block)->next = (to))
+#define SET_PREV(block, to) ((block)->prev = (to))
+#endif
+
+// The settings configure() can change. ARENA and ALIGN stay what the tables
+// below are sized for, so the arena can only shrink and requests can only be
+// rounded up to a multiple of ALIGN. round_to only rounds the sizes of
+// requests up, it does not align memory: blocks are still only 8 byte
+// aligned, since the headers in between are 16 bytes.
+int arena_size = ARENA;
+int round_to = ALIGN;
+int min_size = 8;
+int split_min = 8;
 
 // Implementation of a block header in the free list
 // The block header must be aligned to a multiple of 8 bytes
 // We want to keep the size of this header as small as possible, since it is overhead.
-// Currently, the header size is 24 bytes.
+// Currently, the header size is 16 bytes, or 24 bytes with -DRELATIVE_LINKS=0.
 struct head
 {
     uint16_t bfree; // 2 bytes, the status of the block before
     uint16_t bsize; // 2 bytes, the size of the block before
     uint16_t free; // 2 bytes, the status of this block
     uint16_t size; // 2 bytes, the size of this block (max size is 2^16, that is 64 kbytes)
+#if RELATIVE_LINKS
+    uint32_t next; // 4 bytes, offset of the next block on the free list
+    uint32_t prev; // 4 bytes, offset of the previous block on the free list
+#else
     struct head *next; // 8 bytes, pointer for free list?
     struct head *prev; // 8 bytes, pointer for free list?
+#endif
 };
 
 // The size information of a block, given in the header, will allow us
@@ -62,6 +149,69 @@ struct head *before(struct head *block)
     return (struct head*) (p - HEAD - (block->bsize));
 }
 
+// Running totals behind dstats(). Blocks only join and leave the free lists
+// through insert() and detach(), so that is where the free space is counted.
+// free_sizes[] counts the free blocks of each size, which lets dstats() find
+// the largest one without walking the free lists.
+int free_bytes = 0;
+int free_lengths[CLASSES + 1];
+int blocks = 0;
+uint16_t free_sizes[ARENA / ALIGN + 1];
+int largest = 0; // never smaller than the largest free block
+int flist_largest = 0; // never smaller than the largest block on the general list
+int class_bytes = 0; // bytes in free blocks on the class lists, headers included
+
+void count_free(struct head *block, int flist_no, int change)
+{
+    free_bytes = free_bytes + change * block->size;
+    free_lengths[flist_no] += change;
+    free_sizes[block->size / ALIGN] += change;
+    if(change > 0 && block->size > largest)
+    {
+        largest = block->size;
+    }
+    if(flist_no == 0 && change > 0 && block->size > flist_largest)
+    {
+        flist_largest = block->size;
+    }
+    if(flist_no != 0)
+    {
+        class_bytes = class_bytes + change * (block->size + (int) HEAD);
+    }
+}
+
+// Hot path counters, see dcounters(). They compile to nothing unless the
+// engine is built with -DDALLOC_COUNTERS.
+#ifdef DALLOC_COUNTERS
+__thread struct dcounters hot;
+#define COUNT(field) (hot.field ++)
+#define WALKED(size, n) (hot.examined += (n), hot.walks[size_bucket(size)][walk_bucket(n)] ++)
+#else
+#define COUNT(field)
+#define WALKED(size, n) ((void) (n))
+#endif
+
+// Histogram buckets, see SIZE_BUCKETS and WALK_BUCKETS
+int size_bucket(int size)
+{
+    int i = 0;
+    while(i < SIZE_BUCKETS - 1 && size > (8 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+int walk_bucket(int walked)
+{
+    int i = 0;
+    while(i < WALK_BUCKETS - 1 && walked >= (1 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
 // We also need a procedure that given a (large enough) block and a size, splits
 // the block in tow giving us a pointer to the second block.
 struct head *split(struct head *block, int size)
@@ -83,6 +233,8 @@ struct head *split(struct head *block, int size)
     struct head *aft = after(splt);
     aft->bsize = splt->size;
 
+    blocks ++;
+    COUNT(splits);
     return splt;
 }
 
@@ -90,25 +242,99 @@ struct head *split(struct head *block, int size)
 // Memory for our process.
 struct head *arena = NULL;
 
+#if RELATIVE_LINKS
+// A free list link is the offset of a block from the start of the arena, which
+// takes 4 bytes instead of 8 and makes the header 16 bytes. NONE is the end of
+// a list, since offset 0 is the first block of the arena.
+struct head *block_at(uint32_t offset)
+{
+    if(offset == NONE)
+    {
+        return NULL;
+    }
+    return (struct head*) ((char*) arena + offset);
+}
+
+uint32_t offset_of(struct head *block)
+{
+    if(block == NULL)
+    {
+        return NONE;
+    }
+    return (uint32_t) ((char*) block - (char*) arena);
+}
+#endif
+
+// The top chunk is the part of the arena at the end that has never been
+// handed out. It is a free block, but it is kept off the free lists and
+// allocated from by moving its start along, so there is nothing to search.
+// Blocks freed next to it are merged back into it.
+struct head *top = NULL;
+
 struct head *flist;
-struct head *flist_8;
-struct head *flist_16;
-struct head *flist_24;
-struct head *flist_32;
-struct head *flist_40;
-struct head *flist_48;
-struct head *flist_56;
-struct head *flist_64;
-struct head *flist_72;
-struct head *flist_80;
-struct head *flist_88;
-struct head *flist_96;
-struct head *flist_104;
-struct head *flist_112;
-struct head *flist_120;
-struct head *flist_128;
-
-struct head *midway;
+
+// Requests up to 8 kbytes are served from size classes. Class c hands out
+// blocks of class_size[c] bytes from its own list, and a request goes to the
+// smallest class it fits in, see flist_num(). Class 0 is the general list.
+// The classes go up 8 bytes at a time to 128 bytes and then by eight classes
+// to every doubling, see default_classes(), so rounding a request up to its
+// class never wastes more than one part in nine.
+//
+// The classes do not own a fixed part of the arena. A class which runs dry is
+// given a span of blocks carved out of the general region, see refill(), and
+// a class which is holding on to more free blocks than it needs gives the ones
+// freed after that back to the general region, where they are merged with
+// their neighbours, see dfree(). The classes together never keep more than
+// an IDLE_SHARE:th of the arena in free blocks that way, or what they started
+// out with if that is more, see idle_cap, and when a request
+// cannot be served at all they give back everything they keep, see reclaim().
+//
+// A block which belongs to a class has CLASSED plus its class in the free
+// field, whether it is on the class list or handed out. merge() only takes
+// blocks marked TRUE, so class blocks are left alone until they are given back.
+//
+// The class sizes and how many blocks each class starts out with can be
+// loaded from a file at init(), see load_classes(). Bench/classes.c derives
+// them from a recorded trace.
+//
+// SMALL is the largest of the small classes, the ones that are used the most
+// LIST_SIZE is how many blocks the small classes start out with, unless
+// loaded. The larger classes start out empty.
+// SPAN is how many bytes a class is given each time it runs dry, in as many
+// blocks as fit but no more than REFILL, see batch()
+// IDLE is how many spans worth of free blocks a small class keeps before it
+// gives them back, the larger classes keep one. Either way a class keeps
+// twice what it started out with if that is more.
+// IDLE_SHARE caps what all the classes keep together, as a part of the arena
+#define CLASSED 2
+#define SMALL 128
+#define LIST_SIZE 8
+#define SPAN 1024
+#define REFILL 8
+#define IDLE 5
+#define IDLE_SHARE 16
+
+int classes = CLASSES; // number of classes in use, at most CLASSES
+int class_size[CLASSES + 1];
+int class_capacity[CLASSES + 1];
+struct head *class_lists[CLASSES];
+int idle_cap = 0; // bytes the classes keep at most, set in init()
+
+// The class of each request size, filled in from class_size[] by size_classes()
+unsigned char class_of[ARENA / ALIGN + 1];
+
+// The variable holding the head of each free list
+struct head **head_of(int flist_no)
+{
+    if(flist_no == 0)
+    {
+        return &flist;
+    }
+    else
+    {
+        return &class_lists[flist_no - 1];
+    }
+}
 
 void *new()
 {
@@ -118,592 +344,144 @@ void *new()
         return NULL;
     }
     // Using mmap, but we could have also used sbrk
-    struct head *new = mmap(NULL, ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct head *new = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if(new == MAP_FAILED)
     {
         printf("mmap failed");
         return NULL;
     }
 
-    // Initialise flists
-    int list_size = 20;
-    
-    //8
-    // enough for 8 blocks, and a sentinel
-    uint size_8 = ((8 + HEAD) * list_size)  -  (HEAD);
+    // Make room for head and end-of-list dummy
+    // The whole arena starts out as the top chunk, the size classes are
+    // filled from it by init()
+    uint size = arena_size - 2*HEAD;
     new->bfree = FALSE; // Cannot allocate here
     new->bsize = 0;
     new->free = TRUE; // memory is free
-    new->size = size_8;
-    flist_8 = new;
+    new->size = size;
     arena = new;
+    top = new;
+    flist = NULL;
 
     // Marks the end of the free list
-    struct head *sentinel_8 = after(new);
-    sentinel_8->bfree = TRUE; // memory is free
-    sentinel_8->bsize = size_8;
-    sentinel_8->free = FALSE; // Cannot allocate here
-    sentinel_8->size = 0;
-
-    //16
-    // enough for 16 blocks, and a sentinel
-    flist_16 = after(sentinel_8);
-    uint size_16 = ((16 + HEAD) * list_size)  - (HEAD);
-    flist_16->bfree = FALSE; // Cannot allocate here
-    flist_16->bsize = 0;
-    flist_16->free = TRUE; // memory is free
-    flist_16->size = size_16;
-
-    // Marks the end of the free list
-    struct head *sentinel_16 = after(flist_16);
-    sentinel_16->bfree = TRUE; // memory is free
-    sentinel_16->bsize = size_16;
-    sentinel_16->free = FALSE; // Cannot allocate here
-    sentinel_16->size = 0;
-
-
-    //24
-    // enough for 24 blocks, and a sentinel
-    flist_24 = after(sentinel_16);
-    uint size_24 = ((24 + HEAD) * list_size)  - (HEAD);
-    flist_24->bfree = FALSE; // Cannot allocate here
-    flist_24->bsize = 0;
-    flist_24->free = TRUE; // memory is free
-    flist_24->size = size_24;
-
-    // Marks the end of the free list
-    struct head *sentinel_24 = after(flist_24);
-    sentinel_24->bfree = TRUE; // memory is free
-    sentinel_24->bsize = size_24;
-    sentinel_24->free = FALSE; // Cannot allocate here
-    sentinel_24->size = 0;
-
-    //32
-    // enough for 32 blocks, and a sentinel
-    flist_32 = after(sentinel_24);
-    uint size_32 = ((32 + HEAD) * list_size)  - (HEAD);
-    flist_32->bfree = FALSE; // Cannot allocate here
-    flist_32->bsize = 0;
-    flist_32->free = TRUE; // memory is free
-    flist_32->size = size_32;
-
-    // Marks the end of the free list
-    struct head *sentinel_32 = after(flist_32);
-    sentinel_32->bfree = TRUE; // memory is free
-    sentinel_32->bsize = size_32;
-    sentinel_32->free = FALSE; // Cannot allocate here
-    sentinel_32->size = 0;
-
-    //40
-    // enough for 40 blocks, and a sentinel
-    flist_40 = after(sentinel_32);
-    uint size_40 = ((40 + HEAD) * list_size)  - (HEAD);
-    flist_40->bfree = FALSE; // Cannot allocate here
-    flist_40->bsize = 0;
-    flist_40->free = TRUE; // memory is free
-    flist_40->size = size_40;
-
-    // Marks the end of the free list
-    struct head *sentinel_40 = after(flist_40);
-    sentinel_40->bfree = TRUE; // memory is free
-    sentinel_40->bsize = size_40;
-    sentinel_40->free = FALSE; // Cannot allocate here
-    sentinel_40->size = 0;
-
-    //48
-    // enough for 48 blocks, and a sentinel
-    flist_48 = after(sentinel_40);
-    uint size_48 = ((48 + HEAD) * list_size)  - (HEAD);
-    flist_48->bfree = FALSE; // Cannot allocate here
-    flist_48->bsize = 0;
-    flist_48->free = TRUE; // memory is free
-    flist_48->size = size_48;
-
-    // Marks the end of the free list
-    struct head *sentinel_48 = after(flist_48);
-    sentinel_48->bfree = TRUE; // memory is free
-    sentinel_48->bsize = size_48;
-    sentinel_48->free = FALSE; // Cannot allocate here
-    sentinel_48->size = 0;
-
-    //56
-    // enough for 56 blocks, and a sentinel
-    flist_56 = after(sentinel_48);
-    uint size_56 = ((56 + HEAD) * list_size)  - (HEAD);
-    flist_56->bfree = FALSE; // Cannot allocate here
-    flist_56->bsize = 0;
-    flist_56->free = TRUE; // memory is free
-    flist_56->size = size_56;
-
-    // Marks the end of the free list
-    struct head *sentinel_56 = after(flist_56);
-    sentinel_56->bfree = TRUE; // memory is free
-    sentinel_56->bsize = size_56;
-    sentinel_56->free = FALSE; // Cannot allocate here
-    sentinel_56->size = 0;
-
-    //64
-    // enough for 64 blocks, and a sentinel
-    flist_64 = after(sentinel_56);
-    uint size_64 = ((64 + HEAD) * list_size)  - (HEAD);
-    flist_64->bfree = FALSE; // Cannot allocate here
-    flist_64->bsize = 0;
-    flist_64->free = TRUE; // memory is free
-    flist_64->size = size_64;
-
-    // Marks the end of the free list
-    struct head *sentinel_64 = after(flist_64);
-    sentinel_64->bfree = TRUE; // memory is free
-    sentinel_64->bsize = size_64;
-    sentinel_64->free = FALSE; // Cannot allocate here
-    sentinel_64->size = 0;
-
-    //72
-    // enough for 72 blocks, and a sentinel
-    flist_72 = after(sentinel_64);
-    uint size_72 = ((72 + HEAD) * list_size)  - (HEAD);
-    flist_72->bfree = FALSE; // Cannot allocate here
-    flist_72->bsize = 0;
-    flist_72->free = TRUE; // memory is free
-    flist_72->size = size_72;
-
-
-    // Marks the end of the free list
-    struct head *sentinel_72 = after(flist_72);
-    sentinel_72->bfree = TRUE; // memory is free
-    sentinel_72->bsize = size_72;
-    sentinel_72->free = FALSE; // Cannot allocate here
-    sentinel_72->size = 0;
-
-    //80
-    // enough for 80 blocks, and a sentinel
-    flist_80 = after(sentinel_72);
-    uint size_80 = ((80 + HEAD) * list_size)  - (HEAD);
-    flist_80->bfree = FALSE; // Cannot allocate here
-    flist_80->bsize = 0;
-    flist_80->free = TRUE; // memory is free
-    flist_80->size = size_80;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_80 = after(flist_80);
-    sentinel_80->bfree = TRUE; // memory is free
-    sentinel_80->bsize = size_80;
-    sentinel_80->free = FALSE; // Cannot allocate here
-    sentinel_80->size = 0;
-
-    //88
-    // enough for 88 blocks, and a sentinel
-    flist_88 = after(sentinel_80);
-    uint size_88 = ((88 + HEAD) * list_size)  - (HEAD);
-    flist_88->bfree = FALSE; // Cannot allocate here
-    flist_88->bsize = 0;
-    flist_88->free = TRUE; // memory is free
-    flist_88->size = size_88;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_88 = after(flist_88);
-    sentinel_88->bfree = TRUE; // memory is free
-    sentinel_88->bsize = size_88;
-    sentinel_88->free = FALSE; // Cannot allocate here
-    sentinel_88->size = 0;
-
-    //96
-    // enough for 96 blocks, and a sentinel
-    flist_96 = after(sentinel_88);
-    uint size_96 = ((96 + HEAD) * list_size)  - (HEAD);
-    flist_96->bfree = FALSE; // Cannot allocate here
-    flist_96->bsize = 0;
-    flist_96->free = TRUE; // memory is free
-    flist_96->size = size_96;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_96 = after(flist_96);
-    sentinel_96->bfree = TRUE; // memory is free
-    sentinel_96->bsize = size_96;
-    sentinel_96->free = FALSE; // Cannot allocate here
-    sentinel_96->size = 0;
-
-    //104
-    // enough for 104 blocks, and a sentinel
-    flist_104 = after(sentinel_96);
-    uint size_104 = ((104 + HEAD) * list_size)  - (HEAD);
-    flist_104->bfree = FALSE; // Cannot allocate here
-    flist_104->bsize = 0;
-    flist_104->free = TRUE; // memory is free
-    flist_104->size = size_104;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_104 = after(flist_104);
-    sentinel_104->bfree = TRUE; // memory is free
-    sentinel_104->bsize = size_104;
-    sentinel_104->free = FALSE; // Cannot allocate here
-    sentinel_104->size = 0;
-
-    //112
-    // enough for 112 blocks, and a sentinel
-    flist_112 = after(sentinel_104);
-    uint size_112 = ((112 + HEAD) * list_size)  - (HEAD);
-    flist_112->bfree = FALSE; // Cannot allocate here
-    flist_112->bsize = 0;
-    flist_112->free = TRUE; // memory is free
-    flist_112->size = size_112;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_112 = after(flist_112);
-    sentinel_112->bfree = TRUE; // memory is free
-    sentinel_112->bsize = size_112;
-    sentinel_112->free = FALSE; // Cannot allocate here
-    sentinel_112->size = 0;
-
-    //120
-    // enough for 120 blocks, and a sentinel
-    flist_120 = after(sentinel_112);
-    uint size_120 = ((120 + HEAD) * list_size)  - (HEAD);
-    flist_120->bfree = FALSE; // Cannot allocate here
-    flist_120->bsize = 0;
-    flist_120->free = TRUE; // memory is free
-    flist_120->size = size_120;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_120 = after(flist_120);
-    sentinel_120->bfree = TRUE; // memory is free
-    sentinel_120->bsize = size_120;
-    sentinel_120->free = FALSE; // Cannot allocate here
-    sentinel_120->size = 0;
-
-    //128
-    // enough for 128 blocks, and a sentinel
-    flist_128 = after(sentinel_120);
-    uint size_128 = ((128 + HEAD) * list_size)  - (HEAD);
-    flist_128->bfree = FALSE; // Cannot allocate here
-    flist_128->bsize = 0;
-    flist_128->free = TRUE; // memory is free
-    flist_128->size = size_128;
-    
-
-    // Marks the end of the free list
-    struct head *sentinel_128 = after(flist_128);
-    sentinel_128->bfree = TRUE; // memory is free
-    sentinel_128->bsize = size_128;
-    sentinel_128->free = FALSE; // Cannot allocate here
-    sentinel_128->size = 0;
-    
-    int mem_so_far = size_8 + size_16 + size_24 + size_32 + size_40 + size_48 + size_56 + size_64 + size_72 + size_80 + size_88 + size_96 + size_104 + size_112 + size_120 + size_128 + (32 * HEAD);
-
-    // Make room for head and end-of-list dummy
-    uint size = ARENA - mem_so_far - 2*HEAD;
-    flist = after(sentinel_128);
-    flist->bfree = FALSE; // Cannot allocate here
-    flist->bsize = 0;
-    flist->free = TRUE; // memory is free
-    flist->size = size;
-
-    // Marks the end of the free list
-    struct head *sentinel = after(flist);
+    struct head *sentinel = after(new);
     sentinel->bfree = TRUE; // memory is free
     sentinel->bsize = size;
     sentinel->free = FALSE; // Cannot allocate here
     sentinel->size = 0;
-    
 
-    midway = (struct head*) flist;
+    blocks = 2;
+    return new;
 }
 
-
-struct head *flist;
+// With ADDRESS_ORDER each list remembers where the last insert went
+int address_order = ADDRESS_ORDER;
+int realtime = 0; // see drealtime()
+struct head *hints[CLASSES + 1];
 
 // Used for detaching from the free list (not the same as allocating memory)
 
 void detach(struct head *block, int flist_no)
 {
-    if(block->next != NULL)
+    count_free(block, flist_no, -1);
+    if(hints[flist_no] == block)
+    {
+        hints[flist_no] = NEXT(block) != NULL ? NEXT(block) : PREV(block);
+    }
+    if(NEXT(block) != NULL)
     {
-        block->next->prev = block->prev;
+        SET_PREV(NEXT(block), PREV(block));
     }
-    if(block->prev != NULL)
+    if(PREV(block) != NULL)
     {
-        block->prev->next = block->next;
+        SET_NEXT(PREV(block), NEXT(block));
     }
     else
     {
-        if(flist_no == 0)
-        {
-            flist = block->next;
-        }
-        else if(flist_no == 8)
-        {
-            flist_8 = block->next;
-        }
-        else if(flist_no == 16)
-        {
-            flist_16 = block->next;
-        }
-        else if(flist_no == 24)
-        {
-            flist_24 = block->next;
-        }
-        else if(flist_no == 32)
-        {
-            flist_32 = block->next;
-        }
-        else if(flist_no == 40)
-        {
-            flist_40 = block->next;
-        }
-        else if(flist_no == 48)
-        {
-            flist_48 = block->next;
-        }
-        else if(flist_no == 56)
-        {
-            flist_56 = block->next;
-        }
-        else if(flist_no == 64)
-        {
-            flist_64 = block->next;
-        }
-        else if(flist_no == 72)
-        {
-            flist_72 = block->next;
-        }
-        else if(flist_no == 80)
-        {
-            flist_80 = block->next;
-        }
-        else if(flist_no == 88)
-        {
-            flist_88 = block->next;
-        }
-        else if(flist_no == 96)
-        {
-            flist_96 = block->next;
-        }
-        else if(flist_no == 104)
-        {
-            flist_104 = block->next;
-        }
-        else if(flist_no == 112)
-        {
-            flist_112 = block->next;
-        }
-        else if(flist_no == 120)
-        {
-            flist_120 = block->next;
-        }
-        else if(flist_no == 128)
-        {
-            flist_128 = block->next;
-        }
+        *head_of(flist_no) = NEXT(block);
     }
     
 }
 
 // Used for inserting to free list (not the same as freeing memory)
 
+// Inserts a block so that the list stays sorted by address. The search starts
+// from *last, the block inserted before, which is usually close by, and goes
+// forwards or backwards from there rather than from the head of the list.
+// That walk has no bound, so insert() does not use it in real-time mode, and
+// the list is only mostly in address order after that.
+void insert_ordered(struct head *block, struct head **list, struct head **last)
+{
+    struct head *prev;
+    struct head *next;
+    if(*last == NULL)
+    {
+        prev = NULL;
+        next = *list;
+    }
+    else if(*last < block)
+    {
+        prev = *last;
+        next = NEXT(prev);
+    }
+    else
+    {
+        next = *last;
+        prev = PREV(next);
+    }
+    while(next != NULL && next < block)
+    {
+        prev = next;
+        next = NEXT(next);
+    }
+    while(prev != NULL && prev > block)
+    {
+        next = prev;
+        prev = PREV(prev);
+    }
+
+    SET_PREV(block, prev);
+    SET_NEXT(block, next);
+    if(prev != NULL)
+    {
+        SET_NEXT(prev, block);
+    }
+    else
+    {
+        *list = block;
+    }
+    if(next != NULL)
+    {
+        SET_PREV(next, block);
+    }
+    *last = block;
+}
+
 void insert(struct head *block, int flist_no)
 {
-    
-        if(flist_no == 0)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist != NULL)
-            {
-                block->next = flist;
-                flist->prev = block;  
-            }
-            flist = block;
-        }
-        else if(flist_no == 8)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_8 != NULL)
-            {
-                block->next = flist_8;
-                flist_8->prev = block;  
-            }
-            flist_8 = block;
-        }
-        else if(flist_no == 16)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_16 != NULL)
-            {
-                block->next = flist_16;
-                flist_16->prev = block;  
-            }
-            flist_16 = block;
-        }
-        else if(flist_no == 24)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_24 != NULL)
-            {
-                block->next = flist_24;
-                flist_24->prev = block;  
-            }
-            flist_24 = block;
-        }
-        else if(flist_no == 32)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_32 != NULL)
-            {
-                block->next = flist_32;
-                flist_32->prev = block;  
-            }
-            flist_32 = block;
-        }
-        else if(flist_no == 40)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_40 != NULL)
-            {
-                block->next = flist_40;
-                flist_40->prev = block;  
-            }
-            flist_40 = block;
-        }
-        else if(flist_no == 48)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_48 != NULL)
-            {
-                block->next = flist_48;
-                flist_48->prev = block;  
-            }
-            flist_48 = block;
-        }
-        else if(flist_no == 56)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_56 != NULL)
-            {
-                block->next = flist_56;
-                flist_56->prev = block;  
-            }
-            flist_56 = block;
-        }
-        else if(flist_no == 64)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_64 != NULL)
-            {
-                block->next = flist_64;
-                flist_64->prev = block;  
-            }
-            flist_64 = block;
-        }
-        else if(flist_no == 72)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_72 != NULL)
-            {
-                block->next = flist_72;
-                flist_72->prev = block;  
-            }
-            flist_72 = block;
-        }
-        else if(flist_no == 80)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_80 != NULL)
-            {
-                block->next = flist_80;
-                flist_80->prev = block;  
-            }
-            flist_80 = block;
-        }
-        else if(flist_no == 88)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_88 != NULL)
-            {
-                block->next = flist_88;
-                flist_88->prev = block;  
-            }
-            flist_88 = block;
-        }
-        else if(flist_no == 96)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_96 != NULL)
-            {
-                block->next = flist_96;
-                flist_96->prev = block;  
-            }
-            flist_96 = block;
-        }
-        else if(flist_no == 104)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_104 != NULL)
-            {
-                block->next = flist_104;
-                flist_104->prev = block;  
-            }
-            flist_104 = block;
-        }
-        else if(flist_no == 112)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_112 != NULL)
-            {
-                block->next = flist_112;
-                flist_112->prev = block;  
-            }
-            flist_112 = block;
-        }
-        else if(flist_no == 120)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_120 != NULL)
-            {
-                block->next = flist_120;
-                flist_120->prev = block;  
-            }
-            flist_120 = block;
-        }
-        else if(flist_no == 128)
-        {
-            block->next = NULL;
-            block->prev = NULL;
-            if (flist_128 != NULL)
-            {
-                block->next = flist_128;
-                flist_128->prev = block;  
-            }
-            flist_128 = block;
-        }
+    count_free(block, flist_no, 1);
 
+    struct head **list = head_of(flist_no);
+    if(address_order && !realtime)
+    {
+        insert_ordered(block, list, &hints[flist_no]);
+        return;
+    }
+    SET_NEXT(block, NULL);
+    SET_PREV(block, NULL);
+    if (*list != NULL)
+    {
+        SET_NEXT(block, *list);
+        SET_PREV(*list, block);
+    }
+    *list = block;
 }
 
 int adjust (size_t request)
 {
-    // Adjust the request to a multiple of ALIGN
-    int adj = request / ALIGN;
-    int rem = request % ALIGN;
+    // Adjust the request to a multiple of round_to
+    int adj = request / round_to;
+    int rem = request % round_to;
     int res;
     if(rem == 0)
     {
@@ -711,113 +489,149 @@ int adjust (size_t request)
     }
     else
     {
-        res = (adj * ALIGN) + ALIGN;
+        res = (adj * round_to) + round_to;
     }
 
     return MIN(res);
 }
 
-struct head *find(int size, int flist_no)
+// Splits a block without taking it off its free list. Carving from the back
+// leaves the header of the part that is left over, and so its place on the
+// list, as it is. Carving from the front moves that header up past the part
+// handed out, and its neighbours on the list are pointed at the new position.
+int carve_front = CARVE_FRONT;
+
+struct head *carve(struct head *block, int size, int flist_no)
+{
+    count_free(block, flist_no, -1);
+    if(!carve_front)
+    {
+        struct head *taken = split(block, size);
+        after(taken)->bfree = FALSE;
+        count_free(block, flist_no, 1);
+        return taken;
+    }
+
+    struct head *next = NEXT(block);
+    struct head *prev = PREV(block);
+    int rest = block->size - (size + HEAD);
+    struct head *taken = block;
+    taken->size = size;
+    taken->free = FALSE;
+
+    struct head *remainder = after(taken);
+    remainder->bfree = FALSE;
+    remainder->bsize = size;
+    remainder->free = TRUE;
+    remainder->size = rest;
+    SET_NEXT(remainder, next);
+    SET_PREV(remainder, prev);
+    after(remainder)->bsize = rest;
+    if(next != NULL)
+    {
+        SET_PREV(next, remainder);
+    }
+    if(prev != NULL)
+    {
+        SET_NEXT(prev, remainder);
+    }
+    else
+    {
+        *head_of(flist_no) = remainder;
+    }
+    if(hints[flist_no] == block)
+    {
+        hints[flist_no] = remainder;
+    }
+
+    blocks ++;
+    COUNT(splits);
+    count_free(remainder, flist_no, 1);
+    return taken;
+}
+
+// Real-time mode, see drealtime(). While it is on, find() gives up after
+// looking at this many blocks, and the request is served from the reserve
+// instead. The reserve is one allocated block which we carve pieces off the
+// back of, so taking from it costs the same however full the heap is. Pieces
+// are freed like any other block and end up on the free list.
+struct head *reserve = NULL;
+
+struct head *from_reserve(int size)
+{
+    if(reserve == NULL || reserve->size < size)
+    {
+        return NULL;
+    }
+    if(reserve->size >= LIMIT(size))
+    {
+        struct head *taken = split(reserve, size);
+        taken->bfree = FALSE; // The reserve itself is never free
+        return taken;
+    }
+    else
+    {
+        struct head *taken = reserve;
+        reserve = NULL;
+        return taken;
+    }
+}
+
+struct head *find(int size)
 {
     struct head* to_alloc = NULL;
-    // If the flist does not exist..
-    if(flist_no == 0 && flist == NULL)
+    int walked = 0;
+    COUNT(searches);
+    // If the flist does not exist, or nothing on it is big enough, fail
+    // straight away rather than walking the whole list to find out
+    if(flist == NULL || size > flist_largest)
     {
+        WALKED(size, 0);
+        COUNT(failed);
         return NULL;
     }
     else
     {
         // While the flist is free (i.e. before we reach the sentinel)
         // Search list until we find a space big enough
-        struct head* current;
-        if(flist_no == 0)
-        {
-            current = flist;
-        }
-        else if(flist_no == 8)
-        {
-            current = flist_8;
-        }
-        else if(flist_no == 16)
-        {
-            current = flist_16;
-        }
-        else if(flist_no == 24)
-        {
-            current = flist_24;
-        }
-        else if(flist_no == 32)
-        {
-            current = flist_32;
-        }
-        else if(flist_no == 40)
-        {
-            current = flist_40;
-        }
-        else if(flist_no == 48)
-        {
-            current = flist_48;
-        }
-        else if(flist_no == 56)
-        {
-            current = flist_56;
-        }
-        else if(flist_no == 64)
-        {
-            current = flist_64;
-        }
-        else if(flist_no == 72)
-        {
-            current = flist_72;
-        }
-        else if(flist_no == 80)
-        {
-            current = flist_80;
-        }
-        else if(flist_no == 88)
-        {
-            current = flist_88;
-        }
-        else if(flist_no == 96)
-        {
-            current = flist_96;
-        }
-        else if(flist_no == 104)
-        {
-            current = flist_104;
-        }
-        else if(flist_no == 112)
-        {
-            current = flist_112;
-        }
-        else if(flist_no == 120)
-        {
-            current = flist_120;
-        }
-        else if(flist_no == 128)
-        {
-            current = flist_128;
-        }
+        struct head* current = flist;
+        int biggest = 0;
 
         while(current != NULL)
         {
+            if(realtime && walked == realtime)
+            {
+                break;
+            }
+            walked ++;
             int c_size = current->size;
+            if(c_size > biggest)
+            {
+                biggest = c_size;
+            }
             if(c_size >= size)
             {
-                // If we find a block large enough, detach it from free list
+                // If we find a block large enough, take it
                 to_alloc = current;
-                detach(to_alloc, flist_no);
                 break;
             }
             else
             {
-                current = current->next;
+                current = NEXT(current);
             }
         }
 
+        WALKED(size, walked);
+
         // If we have not found anything big enough, return NULL
         if (to_alloc == NULL)
         {
+            // If the whole list was walked, now we know how big its largest block is
+            if(current == NULL)
+            {
+                flist_largest = biggest;
+            }
+            COUNT(failed);
             return NULL;
         }
         else
@@ -825,16 +639,13 @@ struct head *find(int size, int flist_no)
             // if the block we have found it big enough to split
             if(to_alloc->size >= LIMIT(size))
             {
-                // Split it
-                struct head* split_alloc = split(to_alloc, size);
-                // Reattach the unused memory back onto free list
-                insert(before(split_alloc), flist_no);
-                after(split_alloc)->bfree = FALSE;
-                return split_alloc;
+                // Split it, leaving the unused memory where it is on the free list
+                return carve(to_alloc, size, 0);
             }
             else
             {
-                // Mark the allocated space as not free
+                // Detach it from free list and mark the allocated space as not free
+                detach(to_alloc, 0);
                 to_alloc->free = FALSE;
                 after(to_alloc)->bfree = FALSE;
                 return to_alloc;
@@ -843,6 +654,56 @@ struct head *find(int size, int flist_no)
     }
 }
 
+// Takes a block off the front of the top chunk
+struct head *from_top(int size)
+{
+    if(top == NULL || top->size < size)
+    {
+        return NULL;
+    }
+    struct head *taken = top;
+    if(top->size >= LIMIT(size))
+    {
+        int rest = top->size - (size + HEAD);
+        taken->size = size;
+        top = after(taken);
+        top->bfree = FALSE;
+        top->bsize = size;
+        top->free = TRUE;
+        top->size = rest;
+        after(top)->bsize = rest;
+        blocks ++;
+    }
+    else
+    {
+        top = NULL;
+        after(taken)->bfree = FALSE;
+    }
+    taken->free = FALSE;
+    return taken;
+}
+
+// Gives a free block, which has already been merged with its neighbours, back
+// to the top chunk. This is also how the top chunk comes back once it has been
+// used up completely and the last block in the arena is freed.
+void to_top(struct head *block)
+{
+    if(top != NULL)
+    {
+        block->size = block->size + top->size + HEAD;
+        blocks --;
+    }
+    top = block;
+    after(top)->bsize = top->size;
+    after(top)->bfree = TRUE;
+}
+
+// The sentinel at the very end of the arena
+struct head *arena_end()
+{
+    return (struct head*) ((char*) arena + arena_size - HEAD);
+}
+
 struct head *merge(struct head *block)
 {
     struct head *aft = after(block);
@@ -855,249 +716,942 @@ struct head *merge(struct head *block)
         bef->size = tot_size;
         aft->bsize = tot_size;
         aft->bfree = TRUE;
+        blocks --;
+        COUNT(merges);
 
         block = bef;
     }
-
-    if(aft->free)
+
+    if(aft->free == TRUE && aft != top)
+    {
+        detach(aft, 0);
+        int size_tot = block->size + aft->size + HEAD;
+        block->size = size_tot;
+        struct head* aftaft = after(aft);
+        aftaft->bsize = size_tot;
+        aftaft->bfree = TRUE;
+        blocks --;
+        COUNT(merges);
+    }
+
+    // Whatever comes next now has a free block before it, so that it can
+    // merge with this one when it is freed in turn
+    after(block)->bfree = TRUE;
+
+    return block;
+}
+
+// Puts a block which is on no list back in the general region, merged with
+// its neighbours
+void give_back(struct head *block)
+{
+    block->free = TRUE;
+
+    struct head *mergey;
+    mergey = merge(block);
+    if(after(mergey) == top || after(mergey) == arena_end())
+    {
+        to_top(mergey);
+    }
+    else
+    {
+        insert(mergey, 0);
+    }
+}
+
+// The built in layout, see class_size[]
+void default_classes()
+{
+    int size = 0;
+    int step = ALIGN;
+    int c;
+    for(c = 1; c <= CLASSES; c ++)
+    {
+        if(size >= 16 * step)
+        {
+            step = step * 2;
+        }
+        size = size + step;
+        class_size[c] = size;
+        if(size <= SMALL)
+        {
+            class_capacity[c] = LIST_SIZE;
+        }
+        else
+        {
+            class_capacity[c] = 0;
+        }
+    }
+    classes = CLASSES;
+}
+
+// How many blocks a class is given when it runs dry
+int batch(int c)
+{
+    int n = SPAN / (class_size[c] + HEAD);
+    if(n > REFILL)
+    {
+        n = REFILL;
+    }
+    if(n < 1)
+    {
+        n = 1;
+    }
+    return n;
+}
+
+// How many free blocks a class keeps, see IDLE
+int idle(int c)
+{
+    int keep = batch(c);
+    if(class_size[c] <= SMALL)
+    {
+        keep = IDLE * batch(c);
+    }
+    if(keep < 2 * class_capacity[c])
+    {
+        keep = 2 * class_capacity[c];
+    }
+    return keep;
+}
+
+// Fills in class_of[] from class_size[]
+void size_classes()
+{
+    int c = 1;
+    int size;
+    for(size = 0; size <= class_size[classes]; size = size + ALIGN)
+    {
+        while(class_size[c] < size)
+        {
+            c ++;
+        }
+        class_of[size / ALIGN] = c;
+    }
+}
+
+// The size class a request is served from, or 0 for the general list if it
+// is bigger than all of them
+int flist_num(int size)
+{
+    if(size > class_size[classes])
+    {
+        return 0;
+    }
+    return class_of[size / ALIGN];
+}
+
+// Gives size class c up to n more free blocks. They are carved one after the
+// other out of a single block taken from the general region, so a refill is
+// one search however many blocks it brings. If there is no room for n blocks
+// we settle for fewer.
+int refill(int c, int n)
+{
+    int size = class_size[c];
+    struct head *run = NULL;
+    while(run == NULL && n > 0)
+    {
+        run = find(n * (size + HEAD) - HEAD);
+        if(run == NULL)
+        {
+            run = from_top(n * (size + HEAD) - HEAD);
+        }
+        if(run == NULL)
+        {
+            n = n / 2;
+        }
+    }
+    if(run == NULL)
+    {
+        return FALSE;
+    }
+
+    // The run may be a little bigger than we asked for, the last block keeps that
+    int slack = run->size - (n * (size + HEAD) - HEAD);
+    struct head *last = (struct head*) ((char*) run + (n - 1) * (size + HEAD));
+    last->size = size + slack;
+    after(last)->bsize = last->size;
+
+    // Inserted from the back, so that the list hands them out in address order
+    int i;
+    for(i = n - 1; i >= 0; i --)
+    {
+        struct head *block = (struct head*) ((char*) run + i * (size + HEAD));
+        if(i > 0)
+        {
+            block->bfree = FALSE;
+            block->bsize = size;
+        }
+        if(i < n - 1)
+        {
+            block->size = size;
+        }
+        block->free = CLASSED + c;
+        insert(block, c);
+    }
+    blocks = blocks + n - 1;
+    return TRUE;
+}
+
+// Headerless small objects. Objects of the small classes are packed into
+// slabs, SLAB bytes each, without a header of their own. A slab is an
+// ordinary allocated block which starts at a multiple of SLAB from the start
+// of the arena, so the slab an object belongs to is found by rounding its
+// address down, and page_map[] says whether that part of the arena is a slab
+// at all. The slab itself, just after its block header, knows the class and
+// size of its objects and keeps the free ones on a list of its own.
+//
+// Classes up to SLAB_MAX bytes use slabs while headerless is on. When no room
+// can be found for a new slab they fall back to the class lists above.
+//
+// Object pools, see dpool_create(), are made of slabs too. Their slabs can
+// span several times SLAB bytes, and have class 0.
+//
+// Slabs start at multiples of SLAB, so without coloring the n:th object of
+// every slab of a class would fall in the same cache set. With coloring the
+// bytes the objects leave over at the end of a slab are used to move the
+// first object along, by one more cache line for every new slab of the class
+// or pool, see new_slab().
+//
+// With thread_lines a slab only holds objects handed to one thread, and its
+// objects start on a new cache line, so objects of different threads never
+// share a line and one thread writing to its objects does not take the line
+// away from another. Small objects that have to come from the class lists,
+// when there is no room for a slab, do not get this.
+struct slab
+{
+    uint16_t flist_no; // the class of the objects, 0 in a pool
+    uint16_t size; // size of each object
+    uint16_t used; // objects handed out
+    uint16_t total; // objects the slab holds
+    char *free; // freed objects, each holding a pointer to the next
+    char *fresh; // objects from here on have never been handed out
+    struct slab *next; // slabs of the same class or pool with room left
+    struct slab *prev;
+    struct dpool *pool; // the pool the slab belongs to, NULL for a class
+};
+
+int headerless = HEADERLESS;
+int coloring = SLAB_COLORING;
+int thread_lines = THREAD_LINES;
+struct slab *slabs[CLASSES + 1];
+int slab_color[CLASSES + 1]; // slabs made for each class so far
+unsigned char page_map[ARENA / SLAB]; // 1 + the part of the arena where the slab starts, 0 if not a slab
+int slab_owner[ARENA / SLAB]; // the thread a slab starting there belongs to, with thread_lines
+int owners = 0; // threads that have been given a number
+__thread int thread_owner = 0; // the number of this thread, 0 until it is given one
+int slab_overhead = 0; // bytes in slabs that can never be handed out
+
+// The first place in a free block where a slab of the given size fits,
+// leaving what is in front of it and behind it either empty or big enough to
+// be a free block
+char *slab_room(struct head *block, int bytes)
+{
+    if(block == NULL || block->size < bytes - HEAD)
+    {
+        return NULL;
+    }
+    char *start = (char*) block;
+    char *end = (char*) after(block);
+    char *at = (char*) arena + ((start - (char*) arena) + SLAB - 1) / SLAB * SLAB;
+    while(at + bytes <= end)
+    {
+        if((at == start || at - start >= (long) LIMIT(0)) && (at + bytes == end || end - (at + bytes) >= (long) LIMIT(0)))
+        {
+            return at;
+        }
+        at = at + SLAB;
+    }
+    return NULL;
+}
+
+// Cuts a slab out of a free block which is on no list. The block is the top
+// chunk or a block from the general list, and what is left of it in front of
+// and behind the slab goes back where it came from.
+struct head *cut_slab(struct head *block, char *at, int bytes)
+{
+    int was_top = block == top;
+    char *end = (char*) after(block);
+    struct head *slab = (struct head*) at;
+    struct head *front = NULL;
+    if(at > (char*) block)
+    {
+        front = block;
+        front->size = at - (char*) block - HEAD;
+        slab->bfree = TRUE;
+        slab->bsize = front->size;
+        blocks ++;
+    }
+    slab->size = bytes - HEAD;
+    slab->free = FALSE;
+
+    struct head *back = NULL;
+    if(at + bytes < end)
+    {
+        back = (struct head*) (at + bytes);
+        back->bfree = FALSE;
+        back->bsize = slab->size;
+        back->free = TRUE;
+        back->size = end - (at + bytes) - HEAD;
+        after(back)->bsize = back->size;
+        blocks ++;
+    }
+    else
+    {
+        after(slab)->bsize = slab->size;
+        after(slab)->bfree = FALSE;
+    }
+
+    if(was_top)
+    {
+        top = back;
+        if(front != NULL)
+        {
+            insert(front, 0);
+        }
+    }
+    else
+    {
+        if(front != NULL)
+        {
+            insert(front, 0);
+        }
+        if(back != NULL)
+        {
+            insert(back, 0);
+        }
+    }
+    return slab;
+}
+
+// Sets up a new slab of objects of the given size, with the first one at
+// the given alignment, from the top chunk if it has room and otherwise from
+// the first block on the general list that does. color is how many slabs of
+// the class or pool came before it.
+struct slab *new_slab(int flist_no, int size, int align, int bytes, int color)
+{
+    char *at = slab_room(top, bytes);
+    struct head *block = top;
+    if(at == NULL && flist_largest >= bytes - (int) HEAD)
+    {
+        int walked = 0;
+        block = flist;
+        while(block != NULL && at == NULL && (!realtime || walked < realtime))
+        {
+            at = slab_room(block, bytes);
+            if(at == NULL)
+            {
+                block = NEXT(block);
+                walked ++;
+            }
+        }
+        if(at != NULL)
+        {
+            detach(block, 0);
+        }
+    }
+    if(at == NULL)
+    {
+        return NULL;
+    }
+    struct slab *slab = HIDE(cut_slab(block, at, bytes));
+    char *first = (char*) (slab + 1);
+    if(thread_lines && flist_no != 0)
+    {
+        first = (char*) arena + ((first - (char*) arena) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    }
+    first = (char*) arena + ((first - (char*) arena) + align - 1) / align * align;
+    slab->flist_no = flist_no;
+    slab->size = size;
+    slab->used = 0;
+    slab->total = (at + bytes - first) / size;
+    if(coloring)
+    {
+        // The first object moves along by a cache line for each color, or by
+        // the alignment if what is left over is less than a line
+        int spare = at + bytes - first - slab->total * size;
+        int step = align > CACHE_LINE ? align : CACHE_LINE;
+        if(spare < step)
+        {
+            step = align;
+        }
+        first = first + color % (spare / step + 1) * step;
+    }
+    slab->free = NULL;
+    slab->fresh = first;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->pool = NULL;
+    int i;
+    for(i = 0; i < bytes / SLAB; i ++)
+    {
+        page_map[(at - (char*) arena) / SLAB + i] = (at - (char*) arena) / SLAB + 1;
+    }
+    slab_owner[(at - (char*) arena) / SLAB] = thread_owner;
+    free_bytes = free_bytes + slab->total * slab->size;
+    slab_overhead = slab_overhead + bytes - HEAD - slab->total * slab->size;
+    return slab;
+}
+
+void dfree(void *memory);
+
+// Gives an empty slab back to the heap
+void release_slab(struct slab *slab)
+{
+    struct head *block = MAGIC(slab);
+    int bytes = block->size + HEAD;
+    int i;
+    for(i = 0; i < bytes / SLAB; i ++)
+    {
+        page_map[((char*) block - (char*) arena) / SLAB + i] = 0;
+    }
+    slab_owner[((char*) block - (char*) arena) / SLAB] = 0;
+    free_bytes = free_bytes - slab->total * slab->size;
+    slab_overhead = slab_overhead - (bytes - HEAD - slab->total * slab->size);
+    dfree(slab);
+}
+
+// The slab an address belongs to, or NULL if it is not in one
+struct slab *slab_of(void *memory)
+{
+    long offset = (char*) memory - (char*) arena;
+    if(offset < 0 || offset >= arena_size || page_map[offset / SLAB] == 0)
+    {
+        return NULL;
+    }
+    struct head *block = (struct head*) ((char*) arena + (page_map[offset / SLAB] - 1) * SLAB);
+    return HIDE(block);
+}
+
+void slab_push(struct slab *slab, struct slab **list)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if(*list != NULL)
+    {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+void slab_unlink(struct slab *slab, struct slab **list)
+{
+    if(slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+    if(slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+}
+
+// Takes an object from the first slab on the list, which must have room.
+// A slab that is full after this leaves the list.
+void *slab_take(struct slab **list)
+{
+    struct slab *slab = *list;
+    char *object;
+    if(slab->free != NULL)
+    {
+        object = slab->free;
+        slab->free = *(char**) object;
+    }
+    else
+    {
+        object = slab->fresh;
+        slab->fresh = slab->fresh + slab->size;
+    }
+    slab->used ++;
+    if(slab->used == slab->total)
+    {
+        slab_unlink(slab, list);
+    }
+    free_bytes = free_bytes - slab->size;
+    return object;
+}
+
+// Puts an object back in its slab, which goes back on the list if it was
+// full. Returns TRUE if the slab is now empty and is not the only one on the
+// list, so that the caller can let it go.
+int slab_put(struct slab *slab, void *memory, struct slab **list)
+{
+    *(char**) memory = slab->free;
+    slab->free = memory;
+    if(slab->used == slab->total)
+    {
+        slab_push(slab, list);
+    }
+    slab->used --;
+    free_bytes = free_bytes + slab->size;
+    return slab->used == 0 && (*list != slab || slab->next != NULL);
+}
+
+// The thread a slab belongs to, with thread_lines
+int owner_of(struct slab *slab)
+{
+    return slab_owner[((char*) MAGIC(slab) - (char*) arena) / SLAB];
+}
+
+// The first slab on the list that belongs to the given thread, other than skip
+struct slab *owned_slab(struct slab *slab, int owner, struct slab *skip)
+{
+    while(slab != NULL && (slab == skip || owner_of(slab) != owner))
+    {
+        slab = slab->next;
+    }
+    return slab;
+}
+
+// With thread_lines an object only comes from a slab of the calling thread,
+// which is moved to the front of the list
+void *slab_alloc(int c)
+{
+    struct slab *slab = slabs[c];
+    if(thread_lines)
+    {
+        if(thread_owner == 0)
+        {
+            owners ++;
+            thread_owner = owners;
+        }
+        slab = owned_slab(slabs[c], thread_owner, NULL);
+        if(slab != NULL && slab != slabs[c])
+        {
+            slab_unlink(slab, &slabs[c]);
+            slab_push(slab, &slabs[c]);
+        }
+    }
+    if(slab == NULL)
+    {
+        slab = new_slab(c, class_size[c], ALIGN, SLAB, slab_color[c]);
+        if(slab == NULL)
+        {
+            return NULL;
+        }
+        slab_color[c] ++;
+        slab_push(slab, &slabs[c]);
+    }
+    return slab_take(&slabs[c]);
+}
+
+// A slab with nothing left in it goes back to the heap, unless it is the
+// only one its class, or with thread_lines its thread, has room in
+void slab_free(struct slab *slab, void *memory)
+{
+    if(slab_put(slab, memory, &slabs[slab->flist_no]))
+    {
+        if(!thread_lines || owned_slab(slabs[slab->flist_no], owner_of(slab), slab) != NULL)
+        {
+            slab_unlink(slab, &slabs[slab->flist_no]);
+            release_slab(slab);
+        }
+    }
+}
+
+// Gives every free block the classes keep back to the general region, and
+// lets go of the slabs that are empty, so that their space can be merged with
+// its neighbours again. dalloc() does this when nothing else can serve a
+// request. Returns TRUE if anything was given back.
+int reclaim()
+{
+    int given = FALSE;
+    int c;
+    for(c = 1; c <= classes; c ++)
+    {
+        struct head **list = head_of(c);
+        while(*list != NULL)
+        {
+            struct head *block = *list;
+            detach(block, c);
+            give_back(block);
+            given = TRUE;
+        }
+        struct slab *slab = slabs[c];
+        while(slab != NULL)
+        {
+            struct slab *next = slab->next;
+            if(slab->used == 0)
+            {
+                slab_unlink(slab, &slabs[c]);
+                release_slab(slab);
+                given = TRUE;
+            }
+            slab = next;
+        }
+    }
+    return given;
+}
+
+// Object pools hand out objects of one size from slabs of their own, with no
+// header in front of each object. Everything in a pool can be given back at
+// once with dpool_destroy().
+struct dpool
+{
+    int size; // size of each object, a multiple of the alignment
+    int align;
+    int bytes; // size of each slab
+    struct slab *slabs; // slabs with room left
+    struct slab *full; // slabs without, only kept for dpool_destroy()
+    int color; // slabs made for the pool so far
+};
+
+// Makes a pool for objects of the given size, with every object aligned to
+// the given power of two, up to SLAB, or just ALIGN for 0. A slab holds at least eight objects
+// where that fits in a quarter of the arena.
+struct dpool *dpool_create(size_t object_size, size_t alignment)
+{
+    if(object_size == 0 || alignment > SLAB || (alignment & (alignment - 1)) != 0)
+    {
+        printf("Invalid pool of %zu bytes aligned to %zu\n", object_size, alignment);
+        return NULL;
+    }
+    if(alignment < ALIGN)
+    {
+        alignment = ALIGN;
+    }
+    // No slab is bigger than a quarter of the arena, so anything larger can
+    // not be a pool object. Checked before the rounding, which could wrap
+    // around for sizes close to SIZE_MAX, and before the size goes into an int.
+    if(object_size > ARENA / 4 || object_size + alignment < object_size)
+    {
+        printf("Invalid pool of %zu bytes aligned to %zu\n", object_size, alignment);
+        return NULL;
+    }
+    int size = (object_size + alignment - 1) / alignment * alignment;
+    int bytes = SLAB;
+    while(bytes - (int) HEAD - (int) sizeof(struct slab) - (int) alignment < 8 * size && bytes < ARENA / 4)
+    {
+        bytes = bytes * 2;
+    }
+    if(bytes - (int) HEAD - (int) sizeof(struct slab) - (int) alignment < size)
     {
-        detach(aft, 0);
-        int size_tot = block->size + aft->size + HEAD;
-        block->size = size_tot;
-        struct head* aftaft = after(aft);
-        aftaft->bsize = size_tot;
-        aftaft->bfree = TRUE;
+        printf("Invalid pool of %zu bytes aligned to %zu\n", object_size, alignment);
+        return NULL;
     }
-
-    return block;
+    struct dpool *pool = dalloc(sizeof(struct dpool));
+    if(pool == NULL)
+    {
+        return NULL;
+    }
+    pool->size = size;
+    pool->align = alignment;
+    pool->bytes = bytes;
+    pool->slabs = NULL;
+    pool->full = NULL;
+    pool->color = 0;
+    return pool;
 }
 
-int flist_num(int size)
+void *dpool_alloc(struct dpool *pool)
 {
-    if(size == 8)
+    if(pool->slabs == NULL)
     {
-        if(flist_8 != NULL)
-        {
-            return 8;
-        }
-        else
+        struct slab *slab = new_slab(0, pool->size, pool->align, pool->bytes, pool->color);
+        if(slab == NULL)
         {
-            return 0;
+            return NULL;
         }
+        pool->color ++;
+        slab->pool = pool;
+        slab_push(slab, &pool->slabs);
     }
-    else if (size == 16)
+    struct slab *slab = pool->slabs;
+    void *object = slab_take(&pool->slabs);
+    if(slab->used == slab->total)
     {
-        if(flist_16 != NULL)
-        {
-            return 16;
-        }
-        else
-        {
-            return 0;
-        }
+        slab_push(slab, &pool->full);
     }
-    else if (size == 24)
+    return object;
+}
+
+void dpool_free(struct dpool *pool, void *memory)
+{
+    if(memory == NULL)
     {
-        if(flist_24 != NULL)
-        {
-            return 24;
-        }
-        else
-        {
-            return 0;
-        }
+        return;
     }
-    else if (size == 32)
+    struct slab *slab = slab_of(memory);
+    if(slab == NULL || slab->pool != pool)
     {
-        if(flist_32 != NULL)
-        {
-            return 32;
-        }
-        else
-        {
-            return 0;
-        }
+        printf("dpool_free of memory that is not from this pool\n");
+        return;
     }
-    else if (size == 40)
+    if(slab->used == slab->total)
     {
-        if(flist_40 != NULL)
-        {
-            return 40;
-        }
-        else
-        {
-            return 0;
-        }
+        slab_unlink(slab, &pool->full);
     }
-    else if (size == 48)
+    if(slab_put(slab, memory, &pool->slabs))
     {
-        if(flist_48 != NULL)
-        {
-            return 48;
-        }
-        else
-        {
-            return 0;
-        }
+        slab_unlink(slab, &pool->slabs);
+        release_slab(slab);
     }
-    else if (size == 56)
+}
+
+// Gives every slab of the pool back to the heap, whatever is still in use
+void dpool_destroy(struct dpool *pool)
+{
+    struct slab **lists[2] = {&pool->slabs, &pool->full};
+    int i;
+    for(i = 0; i < 2; i ++)
     {
-        if(flist_56 != NULL)
-        {
-            return 56;
-        }
-        else
+        while(*lists[i] != NULL)
         {
-            return 0;
+            struct slab *slab = *lists[i];
+            slab_unlink(slab, lists[i]);
+            free_bytes = free_bytes + slab->used * slab->size;
+            slab->used = 0;
+            release_slab(slab);
         }
     }
-    else if (size == 64)
+    dfree(pool);
+}
+
+void *dalloc(size_t request)
+{
+    if (request <= 0)
     {
-        if(flist_64 != NULL)
-        {
-            return 64;
-        }
-        else
-        {
-            return 0;
-        }
+        printf("Invalid Dalloc Request");
+        return NULL;
     }
-    else if (size == 72)
+    int size = adjust(request);
+    int flist_no = flist_num(size);
+    if(flist_no != 0 && headerless && class_size[flist_no] <= SLAB_MAX)
     {
-        if(flist_72 != NULL)
-        {
-            return 72;
-        }
-        else
+        void *object = slab_alloc(flist_no);
+        if(object != NULL)
         {
-            return 0;
+            COUNT(class_hits[flist_no - 1]);
+            return object;
         }
     }
-    else if (size == 80)
+    if(flist_no != 0)
     {
-        if(flist_80 != NULL)
+        struct head **list = head_of(flist_no);
+        if(*list == NULL)
         {
-            return 80;
+            refill(flist_no, batch(flist_no));
         }
-        else
+        if(*list != NULL)
         {
-            return 0;
+            struct head *block = *list;
+            detach(block, flist_no);
+            COUNT(class_hits[flist_no - 1]);
+            return HIDE(block);
         }
+        // Not even one block to refill the class with, see if the general
+        // list has something that fits
+        COUNT(class_fallbacks[flist_no - 1]);
     }
-    else if (size == 88)
+    struct head *taken = find(size);
+    if(taken == NULL)
     {
-        if(flist_88 != NULL)
-        {
-            return 88;
-        }
-        else
-        {
-            return 0;
-        }
+        taken = from_top(size);
     }
-    else if (size == 96)
+    // Last of all, take back what the classes are keeping and try again.
+    // That is not bounded, so real-time mode goes to the reserve instead.
+    if(taken == NULL && !realtime && reclaim())
     {
-        if(flist_96 != NULL)
+        taken = find(size);
+        if(taken == NULL)
         {
-            return 96;
-        }
-        else
-        {
-            return 0;
+            taken = from_top(size);
         }
     }
-    else if (size == 104)
+    if(taken == NULL && realtime)
     {
-        if(flist_104 != NULL)
-        {
-            return 104;
-        }
-        else
-        {
-            return 0;
-        }
+        taken = from_reserve(size);
     }
-    else if (size == 112)
+    if(taken == NULL)
     {
-        if(flist_112 != NULL)
-        {
-            return 112;
-        }
-        else
-        {
-            return 0;
-        }
+        return NULL;
     }
-    else if (size == 120)
+    else
     {
-        if(flist_120 != NULL)
-        {
-            return 120;
-        }
-        else
+        return HIDE(taken);
+    }
+}
+
+// Turns real-time mode on, with a limit on the number of free blocks a single
+// dalloc() will look at, or off again with a limit of 0. dfree() merges with
+// at most the two neighbours of the block, and with ADDRESS_ORDER it puts the
+// block at the head of the list while real-time mode is on, since finding its
+// place in address order could mean walking the whole list, see insert().
+// The reserve is set aside here, where we can afford a full search. Once it
+// has run out, calling this again sets aside a new one. Turning real-time
+// mode off gives what is left of the reserve back.
+void drealtime(int limit)
+{
+    realtime = 0;
+    if(limit > 0 && reserve == NULL)
+    {
+        reserve = find(RESERVE);
+        if(reserve == NULL)
         {
-            return 0;
+            reserve = from_top(RESERVE);
         }
     }
-    else if (size == 128)
+    if(limit == 0 && reserve != NULL)
+    {
+        struct head *block = reserve;
+        reserve = NULL;
+        dfree(HIDE(block));
+    }
+    realtime = limit;
+}
+
+void dfree(void *memory)
+{
+    if(memory != NULL)
     {
-        if(flist_128 != NULL)
+        struct slab *slab = slab_of(memory);
+        if(slab != NULL && slab->flist_no == 0)
         {
-            return 128;
+            printf("dfree of memory from a pool, use dpool_free\n");
+            return;
         }
-        else
+        if(slab != NULL)
+        {
+            slab_free(slab, memory);
+            return;
+        }
+
+        struct head * block = (struct head*) MAGIC(memory);
+
+        if(block->free >= CLASSED)
         {
-            return 0;
+            int flist_no = block->free - CLASSED;
+            if(free_lengths[flist_no] < idle(flist_no) && class_bytes + block->size + (int) HEAD <= idle_cap)
+            {
+                insert(block, flist_no);
+                return;
+            }
+            // The class has plenty of free blocks already, or the classes
+            // together do, this one goes back to the general region
         }
+        give_back(block);
     }
-    else
+    return;
+}
+
+// Regions hand out memory by moving a pointer along chunks taken with
+// dalloc(), and give it all back together. dregion_reset() only rewinds to
+// the first chunk, the chunks are kept and used again in the same order, and
+// dregion_destroy() frees them. Requests bigger than a chunk get a chunk of
+// their own, which is not kept.
+struct chunk
+{
+    struct chunk *next;
+};
+
+struct dregion
+{
+    size_t chunk_size; // bytes in each chunk after its header
+    struct chunk *first;
+    struct chunk *current; // the chunk memory is handed out from
+    char *bump; // the next free byte in it
+    struct chunk *large; // chunks of their own, freed on reset
+};
+
+// Makes a region which takes its memory from the heap in chunks of the given
+// size, or REGION_CHUNK for 0
+struct dregion *dregion_create(size_t chunk_size)
+{
+    if(chunk_size == 0)
     {
-        return 0;
+        chunk_size = REGION_CHUNK;
     }
+    struct dregion *region = dalloc(sizeof(struct dregion));
+    if(region == NULL)
+    {
+        return NULL;
+    }
+    region->chunk_size = (chunk_size + ALIGN - 1) / ALIGN * ALIGN;
+    region->first = NULL;
+    region->current = NULL;
+    region->bump = NULL;
+    region->large = NULL;
+    return region;
 }
 
-void *dalloc(size_t request)
+void *dregion_alloc(struct dregion *region, size_t size)
 {
-    if (request <= 0)
+    if(size == 0)
     {
-        printf("Invalid Dalloc Request");
+        printf("Invalid region request\n");
         return NULL;
     }
-    int size = adjust(request);
-    int flist_no = flist_num(size);
-    struct head *taken = find(size, flist_no);
-    if(taken == NULL)
+    size = (size + ALIGN - 1) / ALIGN * ALIGN;
+    if(size > region->chunk_size)
     {
-        return NULL;
+        struct chunk *chunk = dalloc(sizeof(struct chunk) + size);
+        if(chunk == NULL)
+        {
+            return NULL;
+        }
+        chunk->next = region->large;
+        region->large = chunk;
+        return chunk + 1;
     }
-    else
+    if(region->current != NULL && (size_t) ((char*) (region->current + 1) + region->chunk_size - region->bump) >= size)
     {
-        return HIDE(taken);
+        void *memory = region->bump;
+        region->bump = region->bump + size;
+        return memory;
     }
-}
 
-// Currently, this is a cheat method as we are just reinserting ablock in the free list (no merging)
-void dfree(void *memory)
-{
-    if(memory != NULL)
+    // The next chunk kept from before a reset, or a new one
+    struct chunk *next = region->current != NULL ? region->current->next : region->first;
+    if(next == NULL)
     {
-        struct head * block = (struct head*) MAGIC(memory);
-
-        //struct head *aft = flist;
-        block->free = TRUE;
-
-        if(block >= midway)
+        next = dalloc(sizeof(struct chunk) + region->chunk_size);
+        if(next == NULL)
+        {
+            return NULL;
+        }
+        next->next = NULL;
+        if(region->current != NULL)
         {
-            struct head *mergey;
-            mergey = merge(block);
-            insert(mergey, 0);
+            region->current->next = next;
         }
         else
         {
-            insert(block, block->size);
+            region->first = next;
         }
     }
-    return;
+    region->current = next;
+    region->bump = (char*) (next + 1) + size;
+    return next + 1;
+}
+
+void free_chunks(struct chunk *chunk)
+{
+    while(chunk != NULL)
+    {
+        struct chunk *next = chunk->next;
+        dfree(chunk);
+        chunk = next;
+    }
+}
+
+// Everything handed out by the region is free again, the chunks are kept
+void dregion_reset(struct dregion *region)
+{
+    free_chunks(region->large);
+    region->large = NULL;
+    region->current = NULL;
+    region->bump = NULL;
+}
+
+void dregion_destroy(struct dregion *region)
+{
+    free_chunks(region->large);
+    free_chunks(region->first);
+    dfree(region);
 }
 
 // Checks that the free list is ok
@@ -1113,23 +1667,26 @@ void sanity()
         printf("I am: %p\n", current);
         printf("flist node free? expected result 1: %d\n", current->free);
         printf("flist node is divisible size? expected result 0: %d\n", (current->size) % ALIGN);
-        printf("node prev: %p\n", current->prev);
-        printf("node next: %p\n", current->next);
+        printf("node prev: %p\n", PREV(current));
+        printf("node next: %p\n", NEXT(current));
         printf("My size is %d\n", current->size);
         printf("\n");
         acc_size = acc_size + current->size;
-        current = current->next;
+        current = NEXT(current);
         length ++;
     }
     printf("Length of the free list: %d\n", length);
     printf("Total size of free list nodes: %d\n", acc_size);
-    printf("Average size of free list nodes: %d\n", acc_size / length);
+    if(length > 0)
+    {
+        printf("Average size of free list nodes: %d\n", acc_size / length);
+    }
 }
 
 void traverse()
 {
     struct head* current = arena;
-    char * end = (char*)arena + ARENA;
+    char * end = (char*)arena + arena_size;
     while((char*)current < end)
     {
         printf("I am: %p\n", current);
@@ -1144,13 +1701,203 @@ void traverse()
     }
 }
 
+// Reads a size class layout, one class per line with its size and how many
+// blocks it starts out with, smallest first. Lines starting with # are
+// comments. If anything is wrong with the file the built in layout is kept.
+int load_classes(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(file == NULL)
+    {
+        printf("Could not open size class file %s\n", path);
+        return FALSE;
+    }
+    int sizes[CLASSES + 1];
+    int capacities[CLASSES + 1];
+    int n = 0;
+    sizes[0] = 0;
+    char line[128];
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        int size;
+        int capacity;
+        if(line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if(sscanf(line, "%d %d", &size, &capacity) != 2)
+        {
+            printf("Bad line in size class file: %s", line);
+            fclose(file);
+            return FALSE;
+        }
+        if(n == CLASSES)
+        {
+            printf("More than %d size classes in %s\n", CLASSES, path);
+            fclose(file);
+            return FALSE;
+        }
+        if(size < MIN(0) || size % ALIGN != 0 || size <= sizes[n] || size > ARENA / 2 || capacity < 0)
+        {
+            printf("Bad size class %d %d in %s\n", size, capacity, path);
+            fclose(file);
+            return FALSE;
+        }
+        n ++;
+        sizes[n] = size;
+        capacities[n] = capacity;
+    }
+    fclose(file);
+    if(n == 0)
+    {
+        printf("No size classes in %s\n", path);
+        return FALSE;
+    }
+
+    classes = n;
+    int c;
+    for(c = 1; c <= n; c ++)
+    {
+        class_size[c] = sizes[c];
+        class_capacity[c] = capacities[c];
+    }
+    return TRUE;
+}
+
+// Changes one setting, see configure()
+int setting(const char *name, int value)
+{
+    if(strcmp(name, "arena") == 0 && value >= 1024 && value <= ARENA && value % ALIGN == 0)
+    {
+        arena_size = value;
+    }
+    else if(strcmp(name, "round") == 0 && value >= ALIGN && value <= 4096 && value % ALIGN == 0)
+    {
+        round_to = value;
+    }
+    else if(strcmp(name, "min") == 0 && value >= 8 && value <= 4096 && value % ALIGN == 0)
+    {
+        min_size = value;
+    }
+    else if(strcmp(name, "split") == 0 && value >= 8 && value <= 4096 && value % ALIGN == 0)
+    {
+        split_min = value;
+    }
+    else if(strcmp(name, "headerless") == 0 && (value == FALSE || value == TRUE))
+    {
+        headerless = value;
+    }
+    else if(strcmp(name, "coloring") == 0 && (value == FALSE || value == TRUE))
+    {
+        coloring = value;
+    }
+    else if(strcmp(name, "thread_lines") == 0 && (value == FALSE || value == TRUE))
+    {
+        thread_lines = value;
+    }
+    else if(strcmp(name, "carve_front") == 0 && (value == FALSE || value == TRUE))
+    {
+        carve_front = value;
+    }
+    else if(strcmp(name, "address_order") == 0 && (value == FALSE || value == TRUE))
+    {
+        address_order = value;
+    }
+    else if(strcmp(name, "capacity") == 0 && value >= 0 && value <= 1024)
+    {
+        int c;
+        for(c = 1; c <= CLASSES; c ++)
+        {
+            class_capacity[c] = value;
+        }
+    }
+    else if(strncmp(name, "capacity", 8) == 0 && atoi(name + 8) >= 1 && atoi(name + 8) <= CLASSES && value >= 0 && value <= 1024)
+    {
+        class_capacity[atoi(name + 8)] = value;
+    }
+    else
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Reads the settings in DALLOC_CONF, a comma separated list of name=value
+// pairs, so that they can be tuned without building the engine again:
+//
+//     DALLOC_CONF=arena=32768,round=16,capacity=4,capacity1=32,address_order=1
+//
+// arena is the size of the arena in bytes, at most 64 kbytes. round is what
+// requests are rounded up to, which does not align the blocks to it, min the
+// smallest block handed out and split the smallest part worth splitting off a
+// block. capacity is how many blocks every size class starts out with, and
+// capacity3=40 sets it for class 3 alone. headerless=0 keeps small objects out
+// of slabs, coloring=0 starts the objects of every slab at the same place and
+// thread_lines=1 gives every thread slabs of its own. A setting which is not
+// known or out of range is reported and the rest are still read.
+void configure()
+{
+    char *conf = getenv("DALLOC_CONF");
+    if(conf == NULL)
+    {
+        return;
+    }
+    char *p = conf;
+    while(*p != '\0')
+    {
+        char name[32];
+        int value;
+        int used;
+        if(sscanf(p, "%31[^=,]=%d%n", name, &value, &used) != 2 || (p[used] != ',' && p[used] != '\0'))
+        {
+            printf("Bad setting in DALLOC_CONF: %s\n", p);
+            return;
+        }
+        if(!setting(name, value))
+        {
+            printf("Unknown or out of range setting in DALLOC_CONF: %s=%d\n", name, value);
+        }
+        p = p + used;
+        if(*p == ',')
+        {
+            p ++;
+        }
+    }
+}
+
 int initiated = FALSE;
 void init()
 {
     if (!initiated)
     {
         initiated = TRUE;
+        default_classes();
+        char *path = getenv("DALLOC_CLASSES");
+        if(path != NULL && path[0] != '\0')
+        {
+            load_classes(path);
+        }
+        // Settings come last, so that they win over the class file
+        configure();
         new();
+        size_classes();
+        int c;
+        for(c = 1; c <= classes; c ++)
+        {
+            // Classes which are kept in slabs only need blocks of their own
+            // once there is no room for another slab
+            if(!headerless || class_size[c] > SLAB_MAX)
+            {
+                refill(c, class_capacity[c]);
+            }
+        }
+        // The blocks the classes start out with can take more than the share,
+        // and the frees that follow should not hand those straight back
+        idle_cap = arena_size / IDLE_SHARE;
+        if(class_bytes > idle_cap)
+        {
+            idle_cap = class_bytes;
+        }
     }
 }
 
@@ -1164,7 +1911,7 @@ int sanity_flists(struct head* flisty)
     while(current != NULL)
     {
         acc_size = acc_size + current->size;
-        current = current->next;
+        current = NEXT(current);
         length ++;
     }
     printf("Length of the free list: %d\n", length);
@@ -1181,24 +1928,54 @@ int sanity_flists(struct head* flisty)
 
 void init_sanity_flists()
 {
-    int sum = 0;   
-    sum +=  sanity_flists(flist_16);
-    sum +=  sanity_flists(flist_24);
-    sum += sanity_flists(flist_32);
-    sum += sanity_flists(flist_40);
-    sum += sanity_flists(flist_48);
-    sum += sanity_flists(flist_56);
-    sum += sanity_flists(flist_64);
-    sum += sanity_flists(flist_72);
-    sum += sanity_flists(flist_80);
-    sum += sanity_flists(flist_88);
-    sum += sanity_flists(flist_96);
-    sum += sanity_flists(flist_104);
-    sum += sanity_flists(flist_112);
-    sum += sanity_flists(flist_120);
-    sum += sanity_flists(flist_128);
+    int sum = 0;
+    int c;
+    for(c = 1; c <= classes; c ++)
+    {
+        sum += sanity_flists(*head_of(c));
+    }
     sum += sanity_flists(flist);
     printf("%d\n", sum);
 }
 
+void dstats(struct dstats *out)
+{
+    // Bring the largest size down to a block that is still free
+    while(largest > 0 && free_sizes[largest / ALIGN] == 0)
+    {
+        largest = largest - ALIGN;
+    }
+
+    memset(out, 0, sizeof(struct dstats));
+    if(top != NULL)
+    {
+        out->top = top->size;
+    }
+    out->free = free_bytes + out->top;
+    out->overhead = blocks * HEAD + slab_overhead;
+    out->in_use = arena_size - out->overhead - out->free;
+    out->largest_free = largest;
+    if(out->top > out->largest_free)
+    {
+        out->largest_free = out->top;
+    }
+    out->blocks = blocks;
+    int i;
+    for(i = 0; i <= CLASSES; i ++)
+    {
+        out->lengths[i] = free_lengths[i];
+    }
+    for(i = 0; i < classes; i ++)
+    {
+        out->class_free[i] = free_sizes[class_size[i + 1] / ALIGN];
+    }
+}
 
+void dcounters(struct dcounters *out)
+{
+#ifdef DALLOC_COUNTERS
+    *out = hot;
+#else
+    memset(out, 0, sizeof(struct dcounters));
+#endif
+}
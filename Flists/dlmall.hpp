@@ -0,0 +1,295 @@
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+#include "dlmall.h"
+
+// C++ front end to the Flists engine. dlmall::allocator<T> can be given to any
+// standard container, and the memory resources to the std::pmr containers, so
+// that a program can move one container at a time onto the engine instead of
+// replacing malloc for everything. Include it instead of dlmall.h:
+//
+//     std::vector<int, dlmall::allocator<int>> numbers;
+//
+//     dlmall::region_resource scratch;
+//     std::pmr::vector<int> lines(&scratch);
+//
+// The engine is not thread safe, and neither is anything here. Memory is
+// ALIGN aligned unless more is asked for, either by the type or by the
+// alignment passed to a resource, in which case a little more is taken and the
+// address the engine handed out is kept just in front of the memory.
+//
+// Failures throw std::bad_alloc, as the standard library expects.
+
+namespace dlmall
+{
+
+// The alignment of everything the engine hands out, ALIGN in dlmall.c
+constexpr std::size_t align = 8;
+
+// The size of the arena, ARENA in dlmall.c. The engine takes sizes as an int,
+// so anything larger has to be turned away before it gets there, or it would
+// be cut down to a small request and the caller given too little memory.
+constexpr std::size_t arena = 64 * 1024;
+
+inline bool too_large(std::size_t bytes, std::size_t alignment)
+{
+    return bytes > arena || bytes + alignment < bytes;
+}
+
+inline void *allocate(std::size_t bytes, std::size_t alignment = align)
+{
+    init();
+    if(bytes == 0)
+    {
+        bytes = 1;
+    }
+    if(too_large(bytes, alignment))
+    {
+        throw std::bad_alloc();
+    }
+    if(alignment <= align)
+    {
+        void *memory = dalloc(bytes);
+        if(memory == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+    char *raw = (char*) dalloc(bytes + alignment);
+    if(raw == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    // There are always at least align bytes in front of the aligned address
+    // to keep raw in
+    char *memory = (char*) (((std::uintptr_t) raw + alignment) & ~(std::uintptr_t) (alignment - 1));
+    ((char**) memory)[-1] = raw;
+    return memory;
+}
+
+// The engine finds the size of a block itself, so bytes is only there to match
+// the sized deallocation of the standard library. alignment must be the one
+// the memory was allocated with.
+inline void deallocate(void *memory, std::size_t bytes = 0, std::size_t alignment = align)
+{
+    (void) bytes;
+    if(memory == nullptr)
+    {
+        return;
+    }
+    if(alignment <= align)
+    {
+        dfree(memory);
+    }
+    else
+    {
+        dfree(((char**) memory)[-1]);
+    }
+}
+
+// Allocator for the standard containers. There is only one heap, so all of
+// them are equal and memory from one can be freed by any other.
+template<typename T>
+struct allocator
+{
+    typedef T value_type;
+
+    allocator() noexcept
+    {
+    }
+
+    template<typename U>
+    allocator(const allocator<U>&) noexcept
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        if(n > (std::size_t) -1 / sizeof(T))
+        {
+            throw std::bad_alloc();
+        }
+        return (T*) dlmall::allocate(n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T *memory, std::size_t n)
+    {
+        dlmall::deallocate(memory, n * sizeof(T), alignof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept
+{
+    return false;
+}
+
+// Memory resource which goes straight to dalloc() and dfree()
+class heap_resource : public std::pmr::memory_resource
+{
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return dlmall::allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *memory, std::size_t bytes, std::size_t alignment) override
+    {
+        dlmall::deallocate(memory, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const heap_resource*>(&other) != nullptr;
+    }
+};
+
+inline heap_resource *heap()
+{
+    static heap_resource resource;
+    return &resource;
+}
+
+// Memory resource on a region, see dregion_create(). Deallocating does
+// nothing, the memory comes back all at once with release() or when the
+// resource goes away.
+class region_resource : public std::pmr::memory_resource
+{
+public:
+    explicit region_resource(std::size_t chunk_size = 0)
+    {
+        init();
+        region = dregion_create(chunk_size);
+        if(region == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    region_resource(const region_resource&) = delete;
+    region_resource &operator=(const region_resource&) = delete;
+
+    ~region_resource()
+    {
+        dregion_destroy(region);
+    }
+
+    // Everything allocated from the resource is free again
+    void release()
+    {
+        dregion_reset(region);
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if(bytes == 0)
+        {
+            bytes = 1;
+        }
+        if(alignment <= align)
+        {
+            alignment = align;
+        }
+        if(too_large(bytes, alignment))
+        {
+            throw std::bad_alloc();
+        }
+        char *memory = (char*) dregion_alloc(region, bytes + alignment - align);
+        if(memory == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return (void*) (((std::uintptr_t) memory + alignment - 1) & ~(std::uintptr_t) (alignment - 1));
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override
+    {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    struct dregion *region;
+};
+
+// Memory resource on an object pool, see dpool_create(). Requests that fit an
+// object of the pool are served from it, anything else, such as the bucket
+// array of a hash table, goes to the heap.
+class pool_resource : public std::pmr::memory_resource
+{
+public:
+    explicit pool_resource(std::size_t object_size, std::size_t alignment = align)
+    {
+        init();
+        if(alignment < align)
+        {
+            alignment = align;
+        }
+        pool = dpool_create(object_size, alignment);
+        if(pool == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        size = object_size;
+        aligned = alignment;
+    }
+
+    pool_resource(const pool_resource&) = delete;
+    pool_resource &operator=(const pool_resource&) = delete;
+
+    ~pool_resource()
+    {
+        dpool_destroy(pool);
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if(bytes > size || alignment > aligned)
+        {
+            return dlmall::allocate(bytes, alignment);
+        }
+        void *memory = dpool_alloc(pool);
+        if(memory == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+    void do_deallocate(void *memory, std::size_t bytes, std::size_t alignment) override
+    {
+        if(bytes > size || alignment > aligned)
+        {
+            dlmall::deallocate(memory, bytes, alignment);
+        }
+        else
+        {
+            dpool_free(pool, memory);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    struct dpool *pool;
+    std::size_t size;
+    std::size_t aligned;
+};
+
+}
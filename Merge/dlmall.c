@@ -2,45 +2,124 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
+#include "dlmall.h"
 
 // Some definitions for future use:
 // HEAD is important, as we can reference the size of a header easily
 
 // MIN() is the minimum size that we will hand out. The minimum size, apart
-// from the header, that a block will consist of. Currently, it is set to 8 bytes
+// from the header, that a block will consist of. Currently, it is set to 8 bytes,
+// see min_size
 
 // LIMIT() is the size that a block has to be larger than in order to split it.
 // For example, if we want to split a block to accommodate 32 bytes, the block must
-// be LIMIT(32) = 8 + 24 + 32
+// be LIMIT(32) = 8 + 16 + 32, where the 8 is split_min
 
 // MACIC() and HIDE() are used as a way of hiding and retrieving the header
 
 // ALIGN reminds us that memory which is returned needs to be aligned with 8 bytes, on a 64 bit architecture
 
 // ARENA is a large block which we allocate at the beginning, i.e the whole 64 kbyte heap.
+
+// RESERVE is how much of the arena real-time mode sets aside for when a search is cut short
+
+// CARVE_FRONT decides which end of a free block is handed out when it is split,
+// see carve(). It can be changed when building with -DCARVE_FRONT=1
+
+// ADDRESS_ORDER keeps the free lists sorted by address instead of putting freed
+// blocks at the head, see insert(). It can be turned on with -DADDRESS_ORDER=1
+
+// RELATIVE_LINKS keeps the free list links in a header as 32 bit offsets from
+// the start of the arena instead of pointers, see block_at(). It can be turned off
+// with -DRELATIVE_LINKS=0
+
+// Persistent and Shared are this engine with the arena in a file or in shared
+// memory, and they build on this file rather than copying it. ENTER() and
+// LEAVE() go around every call that looks at or changes the heap, and ENTER()
+// gives FALSE when the heap must not be touched. OPEN_ARENA() is what init()
+// maps the arena with, and FREE_SIZES is where the counts behind dstats() are
+// kept, see free_sizes[]. Here they do nothing more than the engine needs.
+
+// Most of these can also be changed when the program starts, see configure()
 #define TRUE 1
 #define FALSE 0
 #define HEAD (sizeof(struct head))
-#define MIN(size) (((size)>(8))?(size):(8))
-#define LIMIT(size) (MIN(0) + HEAD + size)
+#define MIN(size) (((size)>(min_size))?(size):(min_size))
+#define LIMIT(size) (split_min + HEAD + size)
 #define MAGIC(memory) ((struct head*) memory - 1)
 #define HIDE(block) (void*)((struct head*) block + 1)
 #define ALIGN 8
 #define ARENA (64*1024)
+#define RESERVE 4096
+
+#ifndef CARVE_FRONT
+#define CARVE_FRONT FALSE
+#endif
+
+#ifndef ADDRESS_ORDER
+#define ADDRESS_ORDER FALSE
+#endif
+
+#ifndef RELATIVE_LINKS
+#define RELATIVE_LINKS TRUE
+#endif
+
+#ifndef ENTER
+#define ENTER() TRUE
+#endif
+
+#ifndef LEAVE
+#define LEAVE()
+#endif
+
+#ifndef OPEN_ARENA
+#define OPEN_ARENA() new()
+#endif
+
+// NEXT() and PREV() follow the free list links of a block and SET_NEXT() and
+// SET_PREV() change them, whichever way they are kept
+#if RELATIVE_LINKS
+#define NONE 0xffffffff
+#define NEXT(block) (block_at((block)->next))
+#define PREV(block) (block_at((block)->prev))
+#define SET_NEXT(block, to) ((block)->next = offset_of(to))
+#define SET_PREV(block, to) ((block)->prev = offset_of(to))
+#else
+#define NEXT(block) ((block)->next)
+#define PREV(block) ((block)->prev)
+#define SET_NEXT(block, to) ((block)->next = (to))
+#define SET_PREV(block, to) ((block)->prev = (to))
+#endif
+
+// The settings configure() can change. ARENA and ALIGN stay what the tables
+// below are sized for, so the arena can only shrink and requests can only be
+// rounded up to a multiple of ALIGN. round_to only rounds the sizes of
+// requests up, it does not align memory: blocks are still only 8 byte
+// aligned, since the headers in between are 16 bytes.
+int arena_size = ARENA;
+int round_to = ALIGN;
+int min_size = 8;
+int split_min = 8;
 
 // Implementation of a block header in the free list
 // The block header must be aligned to a multiple of 8 bytes
 // We want to keep the size of this header as small as possible, since it is overhead.
-// Currently, the header size is 24 bytes.
+// Currently, the header size is 16 bytes, or 24 bytes with -DRELATIVE_LINKS=0.
 struct head
 {
     uint16_t bfree; // 2 bytes, the status of the block before
     uint16_t bsize; // 2 bytes, the size of the block before
     uint16_t free; // 2 bytes, the status of this block
     uint16_t size; // 2 bytes, the size of this block (max size is 2^16, that is 64 kbytes)
+#if RELATIVE_LINKS
+    uint32_t next; // 4 bytes, offset of the next block on the free list
+    uint32_t prev; // 4 bytes, offset of the previous block on the free list
+#else
     struct head *next; // 8 bytes, pointer for free list?
     struct head *prev; // 8 bytes, pointer for free list?
+#endif
 };
 
 // The size information of a block, given in the header, will allow us
@@ -62,6 +141,62 @@ struct head *before(struct head *block)
     return (struct head*) (p - HEAD - (block->bsize));
 }
 
+// Running totals behind dstats(). Blocks only join and leave the free list
+// through insert() and detach(), so that is where the free space is counted.
+// free_sizes[] counts the free blocks of each size, which lets dstats() find
+// the largest one without walking the free list.
+int free_bytes = 0;
+int free_length = 0;
+int blocks = 0;
+#ifndef FREE_SIZES
+uint16_t free_sizes[ARENA / ALIGN + 1];
+#define FREE_SIZES free_sizes
+#endif
+int largest = 0; // never smaller than the largest free block
+
+void count_free(struct head *block, int change)
+{
+    free_bytes = free_bytes + change * block->size;
+    free_length = free_length + change;
+    FREE_SIZES[block->size / ALIGN] += change;
+    if(change > 0 && block->size > largest)
+    {
+        largest = block->size;
+    }
+}
+
+// Hot path counters, see dcounters(). They compile to nothing unless the
+// engine is built with -DDALLOC_COUNTERS.
+#ifdef DALLOC_COUNTERS
+__thread struct dcounters hot;
+#define COUNT(field) (hot.field ++)
+#define WALKED(size, n) (hot.examined += (n), hot.walks[size_bucket(size)][walk_bucket(n)] ++)
+#else
+#define COUNT(field)
+#define WALKED(size, n) ((void) (n))
+#endif
+
+// Histogram buckets, see SIZE_BUCKETS and WALK_BUCKETS
+int size_bucket(int size)
+{
+    int i = 0;
+    while(i < SIZE_BUCKETS - 1 && size > (8 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+int walk_bucket(int walked)
+{
+    int i = 0;
+    while(i < WALK_BUCKETS - 1 && walked >= (1 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
 // We also need a procedure that given a (large enough) block and a size, splits
 // the block in tow giving us a pointer to the second block.
 struct head *split(struct head *block, int size)
@@ -83,6 +218,8 @@ struct head *split(struct head *block, int size)
     struct head *aft = after(splt);
     aft->bsize = splt->size;
 
+    blocks ++;
+    COUNT(splits);
     return splt;
 }
 
@@ -90,27 +227,46 @@ struct head *split(struct head *block, int size)
 // Memory for our process.
 struct head *arena = NULL;
 
-struct head *new()
+#if RELATIVE_LINKS
+// A free list link is the offset of a block from the start of the arena, which
+// takes 4 bytes instead of 8 and makes the header 16 bytes. NONE is the end of
+// a list, since offset 0 is the first block of the arena.
+struct head *block_at(uint32_t offset)
 {
-    if(arena != NULL)
+    if(offset == NONE)
     {
-        printf("One arena already allocated\n");
         return NULL;
     }
-    // Using mmap, but we could have also used sbrk
-    struct head *new = mmap(NULL, ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if(new == MAP_FAILED)
+    return (struct head*) ((char*) arena + offset);
+}
+
+uint32_t offset_of(struct head *block)
+{
+    if(block == NULL)
     {
-        printf("mmap failed");
-        return NULL;
+        return NONE;
     }
+    return (uint32_t) ((char*) block - (char*) arena);
+}
+#endif
 
+// The top chunk is the part of the arena at the end that has never been
+// handed out. It is a free block, but it is kept off the free list and
+// allocated from by moving its start along, so there is nothing to search.
+// Blocks freed next to it are merged back into it.
+struct head *top = NULL;
+
+// Lays out an empty arena of arena_size bytes at new
+struct head *lay_out(struct head *new)
+{
     // Make room for head and end-of-list dummy
-    uint size = ARENA - 2*HEAD;
+    // The whole arena starts out as the top chunk
+    uint size = arena_size - 2*HEAD;
     new->bfree = FALSE; // Cannot allocate here
     new->bsize = 0;
     new->free = TRUE; // memory is free
     new->size = size;
+    top = new;
 
     // Marks the end of the free list
     struct head *sentinel = after(new);
@@ -119,53 +275,143 @@ struct head *new()
     sentinel->free = FALSE; // Cannot allocate here
     sentinel->size = 0;
     
+    blocks = 2;
 
     arena = (struct head*) new;
+    // The block is all of the free list, and its links can only be set once
+    // arena is, since they may be offsets from it
+    SET_NEXT(new, NULL);
+    SET_PREV(new, NULL);
     return new;
 }
 
+struct head *new()
+{
+    if(arena != NULL)
+    {
+        printf("One arena already allocated\n");
+        return NULL;
+    }
+    // Using mmap, but we could have also used sbrk
+    struct head *new = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(new == MAP_FAILED)
+    {
+        printf("mmap failed");
+        return NULL;
+    }
+    return lay_out(new);
+}
+
 struct head *flist;
 
+// With ADDRESS_ORDER we remember where the last insert went
+int address_order = ADDRESS_ORDER;
+int realtime = 0; // see drealtime()
+struct head *hint = NULL;
+
 // Used for detaching from the free list (not the same as allocating memory)
 
 void detach(struct head *block)
 {
-    if(block->next != NULL)
+    count_free(block, -1);
+    if(hint == block)
+    {
+        hint = NEXT(block) != NULL ? NEXT(block) : PREV(block);
+    }
+    if(NEXT(block) != NULL)
     {
-        block->next->prev = block->prev;
+        SET_PREV(NEXT(block), PREV(block));
     }
-    if(block->prev != NULL)
+    if(PREV(block) != NULL)
     {
-        block->prev->next = block->next;
+        SET_NEXT(PREV(block), NEXT(block));
     }
     else
     {
         //block = NULL;
         // If you're removing the first block?
-        flist = block->next;
+        flist = NEXT(block);
     }
     
 }
 
 // Used for inserting to free list (not the same as freeing memory)
 
+// Inserts a block so that the list stays sorted by address. The search starts
+// from *last, the block inserted before, which is usually close by, and goes
+// forwards or backwards from there rather than from the head of the list.
+// That walk has no bound, so insert() does not use it in real-time mode, and
+// the list is only mostly in address order after that.
+void insert_ordered(struct head *block, struct head **list, struct head **last)
+{
+    struct head *prev;
+    struct head *next;
+    if(*last == NULL)
+    {
+        prev = NULL;
+        next = *list;
+    }
+    else if(*last < block)
+    {
+        prev = *last;
+        next = NEXT(prev);
+    }
+    else
+    {
+        next = *last;
+        prev = PREV(next);
+    }
+    while(next != NULL && next < block)
+    {
+        prev = next;
+        next = NEXT(next);
+    }
+    while(prev != NULL && prev > block)
+    {
+        next = prev;
+        prev = PREV(prev);
+    }
+
+    SET_PREV(block, prev);
+    SET_NEXT(block, next);
+    if(prev != NULL)
+    {
+        SET_NEXT(prev, block);
+    }
+    else
+    {
+        *list = block;
+    }
+    if(next != NULL)
+    {
+        SET_PREV(next, block);
+    }
+    *last = block;
+}
+
 void insert(struct head *block)
 {
-    block->next = NULL;
-    block->prev = NULL;
+    count_free(block, 1);
+    if(address_order && !realtime)
+    {
+        insert_ordered(block, &flist, &hint);
+        return;
+    }
+    SET_NEXT(block, NULL);
+    SET_PREV(block, NULL);
     if (flist != NULL)
     {
-        block->next = flist;
-        flist->prev = block;  
+        SET_NEXT(block, flist);
+        SET_PREV(flist, block);
     }
     flist = block;
 }
 
 int adjust (size_t request)
 {
-    // Adjust the request to a multiple of ALIGN
-    int adj = request / ALIGN;
-    int rem = request % ALIGN;
+    // Adjust the request to a multiple of round_to
+    int adj = request / round_to;
+    int rem = request % round_to;
     int res;
     if(rem == 0)
     {
@@ -173,18 +419,105 @@ int adjust (size_t request)
     }
     else
     {
-        res = (adj * ALIGN) + ALIGN;
+        res = (adj * round_to) + round_to;
     }
 
     return MIN(res);
 }
 
+// Splits a block without taking it off its free list. Carving from the back
+// leaves the header of the part that is left over, and so its place on the
+// list, as it is. Carving from the front moves that header up past the part
+// handed out, and its neighbours on the list are pointed at the new position.
+int carve_front = CARVE_FRONT;
+
+struct head *carve(struct head *block, int size, struct head **list)
+{
+    count_free(block, -1);
+    if(!carve_front)
+    {
+        struct head *taken = split(block, size);
+        after(taken)->bfree = FALSE;
+        count_free(block, 1);
+        return taken;
+    }
+
+    struct head *next = NEXT(block);
+    struct head *prev = PREV(block);
+    int rest = block->size - (size + HEAD);
+    struct head *taken = block;
+    taken->size = size;
+    taken->free = FALSE;
+
+    struct head *remainder = after(taken);
+    remainder->bfree = FALSE;
+    remainder->bsize = size;
+    remainder->free = TRUE;
+    remainder->size = rest;
+    SET_NEXT(remainder, next);
+    SET_PREV(remainder, prev);
+    after(remainder)->bsize = rest;
+    if(next != NULL)
+    {
+        SET_PREV(next, remainder);
+    }
+    if(prev != NULL)
+    {
+        SET_NEXT(prev, remainder);
+    }
+    else
+    {
+        *list = remainder;
+    }
+    if(hint == block)
+    {
+        hint = remainder;
+    }
+
+    blocks ++;
+    COUNT(splits);
+    count_free(remainder, 1);
+    return taken;
+}
+
+// Real-time mode, see drealtime(). While it is on, find() gives up after
+// looking at this many blocks, and the request is served from the reserve
+// instead. The reserve is one allocated block which we carve pieces off the
+// back of, so taking from it costs the same however full the heap is. Pieces
+// are freed like any other block and end up on the free list.
+struct head *reserve = NULL;
+
+struct head *from_reserve(int size)
+{
+    if(reserve == NULL || reserve->size < size)
+    {
+        return NULL;
+    }
+    if(reserve->size >= LIMIT(size))
+    {
+        struct head *taken = split(reserve, size);
+        taken->bfree = FALSE; // The reserve itself is never free
+        return taken;
+    }
+    else
+    {
+        struct head *taken = reserve;
+        reserve = NULL;
+        return taken;
+    }
+}
+
 struct head *find(int size)
 {
     struct head* to_alloc = NULL;
-    // If the flist does not exist..
-    if(flist == NULL)
+    int walked = 0;
+    COUNT(searches);
+    // If the flist does not exist, or nothing on it is big enough, fail
+    // straight away rather than walking the whole list to find out
+    if(flist == NULL || size > largest)
     {
+        WALKED(size, 0);
+        COUNT(failed);
         return NULL;
     }
     else
@@ -192,25 +525,42 @@ struct head *find(int size)
         // While the flist is free (i.e. before we reach the sentinel)
         // Search list until we find a space big enough
         struct head* current = flist;
+        int biggest = 0;
         while(current != NULL)
         {
+            if(realtime && walked == realtime)
+            {
+                break;
+            }
+            walked ++;
             int c_size = current->size;
+            if(c_size > biggest)
+            {
+                biggest = c_size;
+            }
             if(c_size >= size)
             {
-                // If we find a block large enough, detach it from free list
+                // If we find a block large enough, take it
                 to_alloc = current;
-                detach(to_alloc);
                 break;
             }
             else
             {
-                current = current->next;
+                current = NEXT(current);
             }
         }
 
+        WALKED(size, walked);
+
         // If we have not found anything big enough, return NULL
         if (to_alloc == NULL)
         {
+            // If the whole list was walked, now we know how big its largest block is
+            if(current == NULL)
+            {
+                largest = biggest;
+            }
+            COUNT(failed);
             return NULL;
         }
         else
@@ -218,16 +568,13 @@ struct head *find(int size)
             // if the block we have found it big enough to split
             if(to_alloc->size >= LIMIT(size))
             {
-                // Split it
-                struct head* split_alloc = split(to_alloc, size);
-                // Reattach the unused memory back onto free list
-                insert(before(split_alloc));
-                after(split_alloc)->bfree = FALSE;
-                return split_alloc;
+                // Split it, leaving the unused memory where it is on the free list
+                return carve(to_alloc, size, &flist);
             }
             else
             {
-                // Mark the allocated space as not free
+                // Detach it from free list and mark the allocated space as not free
+                detach(to_alloc);
                 to_alloc->free = FALSE;
                 after(to_alloc)->bfree = FALSE;
                 return to_alloc;
@@ -236,6 +583,56 @@ struct head *find(int size)
     }
 }
 
+// Takes a block off the front of the top chunk
+struct head *from_top(int size)
+{
+    if(top == NULL || top->size < size)
+    {
+        return NULL;
+    }
+    struct head *taken = top;
+    if(top->size >= LIMIT(size))
+    {
+        int rest = top->size - (size + HEAD);
+        taken->size = size;
+        top = after(taken);
+        top->bfree = FALSE;
+        top->bsize = size;
+        top->free = TRUE;
+        top->size = rest;
+        after(top)->bsize = rest;
+        blocks ++;
+    }
+    else
+    {
+        top = NULL;
+        after(taken)->bfree = FALSE;
+    }
+    taken->free = FALSE;
+    return taken;
+}
+
+// Gives a free block, which has already been merged with its neighbours, back
+// to the top chunk. This is also how the top chunk comes back once it has been
+// used up completely and the last block in the arena is freed.
+void to_top(struct head *block)
+{
+    if(top != NULL)
+    {
+        block->size = block->size + top->size + HEAD;
+        blocks --;
+    }
+    top = block;
+    after(top)->bsize = top->size;
+    after(top)->bfree = TRUE;
+}
+
+// The sentinel at the very end of the arena
+struct head *arena_end()
+{
+    return (struct head*) ((char*) arena + arena_size - HEAD);
+}
+
 struct head *merge(struct head *block)
 {
     struct head *aft = after(block);
@@ -248,11 +645,13 @@ struct head *merge(struct head *block)
         bef->size = tot_size;
         aft->bsize = tot_size;
         aft->bfree = TRUE;
+        blocks --;
+        COUNT(merges);
 
         block = bef;
     }
 
-    if(aft->free)
+    if(aft->free && aft != top)
     {
         detach(aft);
         int size_tot = block->size + aft->size + HEAD;
@@ -260,11 +659,34 @@ struct head *merge(struct head *block)
         struct head* aftaft = after(aft);
         aftaft->bsize = size_tot;
         aftaft->bfree = TRUE;
+        blocks --;
+        COUNT(merges);
     }
 
+    // Whatever comes next now has a free block before it, so that it can
+    // merge with this one when it is freed in turn
+    after(block)->bfree = TRUE;
+
     return block;
 }
 
+// Gives a block back to the heap, merged with its free neighbours
+void give_back(struct head *block)
+{
+    block->free = TRUE;
+
+    struct head *mergey;
+    mergey = merge(block);
+    if(after(mergey) == top || after(mergey) == arena_end())
+    {
+        to_top(mergey);
+    }
+    else
+    {
+        insert(mergey);
+    }
+}
+
 void *dalloc(size_t request)
 {
     if (request <= 0)
@@ -273,8 +695,21 @@ void *dalloc(size_t request)
         return NULL;
     }
     int size = adjust(request);
+    if(!ENTER())
+    {
+        return NULL;
+    }
     struct head *taken = find(size);
     if(taken == NULL)
+    {
+        taken = from_top(size);
+    }
+    if(taken == NULL && realtime)
+    {
+        taken = from_reserve(size);
+    }
+    LEAVE();
+    if(taken == NULL)
     {
         return NULL;
     }
@@ -284,6 +719,38 @@ void *dalloc(size_t request)
     }
 }
 
+// Turns real-time mode on, with a limit on the number of free blocks a single
+// dalloc() will look at, or off again with a limit of 0. dfree() merges with
+// at most the two neighbours of the block, and with ADDRESS_ORDER it puts the
+// block at the head of the list while real-time mode is on, since finding its
+// place in address order could mean walking the whole list, see insert().
+// The reserve is set aside here, where we can afford a full search. Once it
+// has run out, calling this again sets aside a new one. Turning real-time
+// mode off gives what is left of the reserve back.
+void drealtime(int limit)
+{
+    realtime = 0;
+    if(ENTER())
+    {
+        if(limit > 0 && reserve == NULL)
+        {
+            reserve = find(RESERVE);
+            if(reserve == NULL)
+            {
+                reserve = from_top(RESERVE);
+            }
+        }
+        if(limit == 0 && reserve != NULL)
+        {
+            struct head *block = reserve;
+            reserve = NULL;
+            give_back(block);
+        }
+        LEAVE();
+    }
+    realtime = limit;
+}
+
 // Currently, this is a cheat method as we are just reinserting ablock in the free list (no merging)
 void dfree(void *memory)
 {
@@ -291,16 +758,12 @@ void dfree(void *memory)
     {
         struct head * block = (struct head*) MAGIC(memory);
 
-        struct head *aft = flist;
-        block->free = TRUE;
-
-        struct head *mergey;
-        mergey = merge(block);
-
-        //aft->bfree = TRUE;
-        insert(mergey);
-
-
+        if(!ENTER())
+        {
+            return;
+        }
+        give_back(block);
+        LEAVE();
     }
     return;
 }
@@ -308,6 +771,10 @@ void dfree(void *memory)
 // Checks that the free list is ok
 void sanity()
 {
+    if(!ENTER())
+    {
+        return;
+    }
     int length;
     int acc_size;
     acc_size = 0;
@@ -318,23 +785,31 @@ void sanity()
         printf("I am: %p\n", current);
         printf("flist node free? expected result 1: %d\n", current->free);
         printf("flist node is divisible size? expected result 0: %d\n", (current->size) % ALIGN);
-        printf("node prev: %p\n", current->prev);
-        printf("node next: %p\n", current->next);
+        printf("node prev: %p\n", PREV(current));
+        printf("node next: %p\n", NEXT(current));
         printf("My size is %d\n", current->size);
         printf("\n");
         acc_size = acc_size + current->size;
-        current = current->next;
+        current = NEXT(current);
         length ++;
     }
+    LEAVE();
     printf("Length of the free list: %d\n", length);
     printf("Total size of free list nodes: %d\n", acc_size);
-    printf("Average size of free list nodes: %d\n", acc_size / length);
+    if(length > 0)
+    {
+        printf("Average size of free list nodes: %d\n", acc_size / length);
+    }
 }
 
 void traverse()
 {
+    if(!ENTER())
+    {
+        return;
+    }
     struct head* current = arena;
-    char * end = (char*)arena + ARENA;
+    char * end = (char*)arena + arena_size;
     while((char*)current < end)
     {
         printf("I am: %p\n", current);
@@ -347,6 +822,81 @@ void traverse()
         printf("\n");
         current = after(current);
     }
+    LEAVE();
+}
+
+// Changes one setting, see configure()
+int setting(const char *name, int value)
+{
+    if(strcmp(name, "arena") == 0 && value >= 1024 && value <= ARENA && value % ALIGN == 0)
+    {
+        arena_size = value;
+    }
+    else if(strcmp(name, "round") == 0 && value >= ALIGN && value <= 4096 && value % ALIGN == 0)
+    {
+        round_to = value;
+    }
+    else if(strcmp(name, "min") == 0 && value >= 8 && value <= 4096 && value % ALIGN == 0)
+    {
+        min_size = value;
+    }
+    else if(strcmp(name, "split") == 0 && value >= 8 && value <= 4096 && value % ALIGN == 0)
+    {
+        split_min = value;
+    }
+    else if(strcmp(name, "carve_front") == 0 && (value == FALSE || value == TRUE))
+    {
+        carve_front = value;
+    }
+    else if(strcmp(name, "address_order") == 0 && (value == FALSE || value == TRUE))
+    {
+        address_order = value;
+    }
+    else
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Reads the settings in DALLOC_CONF, a comma separated list of name=value
+// pairs, so that they can be tuned without building the engine again:
+//
+//     DALLOC_CONF=arena=32768,round=16,min=16,split=32,carve_front=1,address_order=1
+//
+// arena is the size of the arena in bytes, at most 64 kbytes. round is what
+// requests are rounded up to, which does not align the blocks to it, min the
+// smallest block handed out and split the smallest part worth splitting off a
+// block. A setting which is not known or
+// out of range is reported and the rest are still read.
+void configure()
+{
+    char *conf = getenv("DALLOC_CONF");
+    if(conf == NULL)
+    {
+        return;
+    }
+    char *p = conf;
+    while(*p != '\0')
+    {
+        char name[32];
+        int value;
+        int used;
+        if(sscanf(p, "%31[^=,]=%d%n", name, &value, &used) != 2 || (p[used] != ',' && p[used] != '\0'))
+        {
+            printf("Bad setting in DALLOC_CONF: %s\n", p);
+            return;
+        }
+        if(!setting(name, value))
+        {
+            printf("Unknown or out of range setting in DALLOC_CONF: %s=%d\n", name, value);
+        }
+        p = p + used;
+        if(*p == ',')
+        {
+            p ++;
+        }
+    }
 }
 
 int initiated = FALSE;
@@ -355,8 +905,51 @@ void init()
     if (!initiated)
     {
         initiated = TRUE;
-        flist = new();
+        configure();
+        OPEN_ARENA();
     }
 }
 
+void dstats(struct dstats *out)
+{
+    memset(out, 0, sizeof(struct dstats));
+    if(!ENTER())
+    {
+        return;
+    }
+    // Bring the largest size down to a block that is still free
+    while(largest > 0 && FREE_SIZES[largest / ALIGN] == 0)
+    {
+        largest = largest - ALIGN;
+    }
 
+    if(top != NULL)
+    {
+        out->top = top->size;
+    }
+    out->free = free_bytes + out->top;
+    out->overhead = blocks * HEAD;
+    out->in_use = arena_size - out->overhead - out->free;
+    out->largest_free = largest;
+    if(out->top > out->largest_free)
+    {
+        out->largest_free = out->top;
+    }
+    out->blocks = blocks;
+    out->lengths[0] = free_length;
+    int i;
+    for(i = 0; i < CLASSES; i ++)
+    {
+        out->class_free[i] = FREE_SIZES[(i + 1) * 8 / ALIGN];
+    }
+    LEAVE();
+}
+
+void dcounters(struct dcounters *out)
+{
+#ifdef DALLOC_COUNTERS
+    *out = hot;
+#else
+    memset(out, 0, sizeof(struct dcounters));
+#endif
+}
@@ -2,7 +2,9 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
+#include "dlmall.h"
 
 // Some definitions for future use:
 // HEAD is important, as we can reference the size of a header easily
@@ -12,13 +14,17 @@
 
 // LIMIT() is the size that a block has to be larger than in order to split it.
 // For example, if we want to split a block to accommodate 32 bytes, the block must
-// be LIMIT(32) = 8 + 24 + 32
+// be LIMIT(32) = 8 + 16 + 32
 
 // MACIC() and HIDE() are used as a way of hiding and retrieving the header
 
 // ALIGN reminds us that memory which is returned needs to be aligned with 8 bytes, on a 64 bit architecture
 
 // ARENA is a large block which we allocate at the beginning, i.e the whole 64 kbyte heap.
+// RELATIVE_LINKS keeps the free list links in a header as 32 bit offsets from
+// the start of the arena instead of pointers, see block_at(). It can be turned off
+// with -DRELATIVE_LINKS=0
+
 #define TRUE 1
 #define FALSE 0
 #define HEAD (sizeof(struct head))
@@ -29,18 +35,42 @@
 #define ALIGN 8
 #define ARENA (64*1024)
 
+#ifndef RELATIVE_LINKS
+#define RELATIVE_LINKS TRUE
+#endif
+
+// NEXT() and PREV() follow the free list links of a block and SET_NEXT() and
+// SET_PREV() change them, whichever way they are kept
+#if RELATIVE_LINKS
+#define NONE 0xffffffff
+#define NEXT(block) (block_at((block)->next))
+#define PREV(block) (block_at((block)->prev))
+#define SET_NEXT(block, to) ((block)->next = offset_of(to))
+#define SET_PREV(block, to) ((block)->prev = offset_of(to))
+#else
+#define NEXT(block) ((block)->next)
+#define PREV(block) ((block)->prev)
+#define SET_NEXT(block, to) ((block)->next = (to))
+#define SET_PREV(block, to) ((block)->prev = (to))
+#endif
+
 // Implementation of a block header in the free list
 // The block header must be aligned to a multiple of 8 bytes
 // We want to keep the size of this header as small as possible, since it is overhead.
-// Currently, the header size is 24 bytes.
+// Currently, the header size is 16 bytes, or 24 bytes with -DRELATIVE_LINKS=0.
 struct head
 {
     uint16_t bfree; // 2 bytes, the status of the block before
     uint16_t bsize; // 2 bytes, the size of the block before
     uint16_t free; // 2 bytes, the status of this block
     uint16_t size; // 2 bytes, the size of this block (max size is 2^16, that is 64 kbytes)
+#if RELATIVE_LINKS
+    uint32_t next; // 4 bytes, offset of the next block on the free list
+    uint32_t prev; // 4 bytes, offset of the previous block on the free list
+#else
     struct head *next; // 8 bytes, pointer for free list?
     struct head *prev; // 8 bytes, pointer for free list?
+#endif
 };
 
 // The size information of a block, given in the header, will allow us
@@ -62,6 +92,59 @@ struct head *before(struct head *block)
     return (struct head*) (p - HEAD - (block->bsize));
 }
 
+// Running totals behind dstats(). Blocks only join and leave the free list
+// through insert() and detach(), so that is where the free space is counted.
+// free_sizes[] counts the free blocks of each size, which lets dstats() find
+// the largest one without walking the free list.
+int free_bytes = 0;
+int free_length = 0;
+int blocks = 0;
+uint16_t free_sizes[ARENA / ALIGN + 1];
+int largest = 0; // never smaller than the largest free block
+
+void count_free(struct head *block, int change)
+{
+    free_bytes = free_bytes + change * block->size;
+    free_length = free_length + change;
+    free_sizes[block->size / ALIGN] += change;
+    if(change > 0 && block->size > largest)
+    {
+        largest = block->size;
+    }
+}
+
+// Hot path counters, see dcounters(). They compile to nothing unless the
+// engine is built with -DDALLOC_COUNTERS.
+#ifdef DALLOC_COUNTERS
+__thread struct dcounters hot;
+#define COUNT(field) (hot.field ++)
+#define WALKED(size, n) (hot.examined += (n), hot.walks[size_bucket(size)][walk_bucket(n)] ++)
+#else
+#define COUNT(field)
+#define WALKED(size, n) ((void) (n))
+#endif
+
+// Histogram buckets, see SIZE_BUCKETS and WALK_BUCKETS
+int size_bucket(int size)
+{
+    int i = 0;
+    while(i < SIZE_BUCKETS - 1 && size > (8 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+int walk_bucket(int walked)
+{
+    int i = 0;
+    while(i < WALK_BUCKETS - 1 && walked >= (1 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
 // We also need a procedure that given a (large enough) block and a size, splits
 // the block in tow giving us a pointer to the second block.
 struct head *split(struct head *block, int size)
@@ -83,6 +166,8 @@ struct head *split(struct head *block, int size)
     struct head *aft = after(splt);
     aft->bsize = splt->size;
 
+    blocks ++;
+    COUNT(splits);
     return splt;
 }
 
@@ -90,6 +175,29 @@ struct head *split(struct head *block, int size)
 // Memory for our process.
 struct head *arena = NULL;
 
+#if RELATIVE_LINKS
+// A free list link is the offset of a block from the start of the arena, which
+// takes 4 bytes instead of 8 and makes the header 16 bytes. NONE is the end of
+// a list, since offset 0 is the first block of the arena.
+struct head *block_at(uint32_t offset)
+{
+    if(offset == NONE)
+    {
+        return NULL;
+    }
+    return (struct head*) ((char*) arena + offset);
+}
+
+uint32_t offset_of(struct head *block)
+{
+    if(block == NULL)
+    {
+        return NONE;
+    }
+    return (uint32_t) ((char*) block - (char*) arena);
+}
+#endif
+
 struct head *new()
 {
     if(arena != NULL)
@@ -119,8 +227,14 @@ struct head *new()
     sentinel->free = FALSE; // Cannot allocate here
     sentinel->size = 0;
     
+    blocks = 2;
+    count_free(new, 1);
 
     arena = (struct head*) new;
+    // The block is all of the free list, and its links can only be set once
+    // arena is, since they may be offsets from it
+    SET_NEXT(new, NULL);
+    SET_PREV(new, NULL);
     return new;
 }
 
@@ -130,19 +244,20 @@ struct head *flist;
 
 void detach(struct head *block)
 {
-    if(block->next != NULL)
+    count_free(block, -1);
+    if(NEXT(block) != NULL)
     {
-        block->next->prev = block->prev;
+        SET_PREV(NEXT(block), PREV(block));
     }
-    if(block->prev != NULL)
+    if(PREV(block) != NULL)
     {
-        block->prev->next = block->next;
+        SET_NEXT(PREV(block), NEXT(block));
     }
     else
     {
         //block = NULL;
         // If you're removing the first block?
-        flist = block->next;
+        flist = NEXT(block);
     }
     
 }
@@ -151,12 +266,13 @@ void detach(struct head *block)
 
 void insert(struct head *block)
 {
-    block->next = NULL;
-    block->prev = NULL;
+    count_free(block, 1);
+    SET_NEXT(block, NULL);
+    SET_PREV(block, NULL);
     if (flist != NULL)
     {
-        block->next = flist;
-        flist->prev = block;  
+        SET_NEXT(block, flist);
+        SET_PREV(flist, block);
     }
     flist = block;
 }
@@ -182,9 +298,14 @@ int adjust (size_t request)
 struct head *find(int size)
 {
     struct head* to_alloc = NULL;
-    // If the flist does not exist..
-    if(flist == NULL)
+    int walked = 0;
+    COUNT(searches);
+    // If the flist does not exist, or nothing on it is big enough, fail
+    // straight away rather than walking the whole list to find out
+    if(flist == NULL || size > largest)
     {
+        WALKED(size, 0);
+        COUNT(failed);
         return NULL;
     }
     else
@@ -192,9 +313,15 @@ struct head *find(int size)
         // While the flist is free (i.e. before we reach the sentinel)
         // Search list until we find a space big enough
         struct head* current = flist;
+        int biggest = 0;
         while(current != NULL)
         {
+            walked ++;
             int c_size = current->size;
+            if(c_size > biggest)
+            {
+                biggest = c_size;
+            }
             if(c_size >= size)
             {
                 // If we find a block large enough, detach it from free list
@@ -204,13 +331,18 @@ struct head *find(int size)
             }
             else
             {
-                current = current->next;
+                current = NEXT(current);
             }
         }
 
+        WALKED(size, walked);
+
         // If we have not found anything big enough, return NULL
         if (to_alloc == NULL)
         {
+            // The whole list was walked, so now we know how big its largest block is
+            largest = biggest;
+            COUNT(failed);
             return NULL;
         }
         else
@@ -284,11 +416,11 @@ void sanity()
         printf("I am: %p\n", current);
         printf("flist node free? expected result 1: %d\n", current->free);
         printf("flist node is divisible size? expected result 0: %d\n", (current->size) % ALIGN);
-        printf("node prev: %p\n", current->prev);
-        printf("node next: %p\n", current->next);
+        printf("node prev: %p\n", PREV(current));
+        printf("node next: %p\n", NEXT(current));
         printf("\n");
         acc_size = acc_size + current->size;
-        current = current->next;
+        current = NEXT(current);
         length ++;
     }
     printf("Length of the free list: %d\n", length);
@@ -324,4 +456,33 @@ void init()
     }
 }
 
+void dstats(struct dstats *out)
+{
+    // Bring the largest size down to a block that is still free
+    while(largest > 0 && free_sizes[largest / ALIGN] == 0)
+    {
+        largest = largest - ALIGN;
+    }
+
+    memset(out, 0, sizeof(struct dstats));
+    out->free = free_bytes;
+    out->overhead = blocks * HEAD;
+    out->in_use = ARENA - out->overhead - free_bytes;
+    out->largest_free = largest;
+    out->blocks = blocks;
+    out->lengths[0] = free_length;
+    int i;
+    for(i = 0; i < CLASSES; i ++)
+    {
+        out->class_free[i] = free_sizes[(i + 1) * 8 / ALIGN];
+    }
+}
 
+void dcounters(struct dcounters *out)
+{
+#ifdef DALLOC_COUNTERS
+    *out = hot;
+#else
+    memset(out, 0, sizeof(struct dcounters));
+#endif
+}
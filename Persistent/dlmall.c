@@ -0,0 +1,374 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// The Merge engine on an arena that can live in a file. With DALLOC_HEAP set,
+// or after dopen(), the arena is a shared mapping of that file, so whatever is
+// allocated in it is still there the next time the file is opened, by this
+// process or another one. The free list links in the headers are offsets
+// from the start of the arena rather than pointers, and a superblock in front
+// of the arena keeps the reserve and a root, so the heap works wherever the
+// file is mapped. Data kept in the heap has to link to other data in it the
+// same way, see doffset() and dpointer(). Only one process has a heap file
+// open at a time, see dopen().
+
+// Everything but the file is the Merge engine, which is included below. The
+// hooks it leaves, see the top of Merge/dlmall.c, mark the heap busy while a
+// call changes it, keep the counts of free blocks of each size in the
+// superblock and map the file when the program starts.
+#undef RELATIVE_LINKS
+#define RELATIVE_LINKS 1
+#define ENTER() enter()
+#define LEAVE() leave()
+#define OPEN_ARENA() open_heap()
+#define FREE_SIZES heap_sizes
+
+int enter();
+void leave();
+void open_heap();
+uint16_t *heap_sizes = NULL; // free_sizes[] in the superblock
+
+#include "../Merge/dlmall.c"
+
+// HEAP_MAGIC and HEAP_VERSION tell a heap file from anything else
+#define SUPER (sizeof(struct superblock))
+#define HEAP_MAGIC 0x48414c44
+#define HEAP_VERSION 3
+
+// The start of the heap file, the arena follows it. The blocks in it are
+// offsets from the start of the arena, as the links in the headers are, and
+// the root one from the start of the file, as doffset() gives.
+struct superblock
+{
+    uint32_t magic; // HEAP_MAGIC
+    uint32_t version; // HEAP_VERSION
+    uint32_t size; // bytes in the heap, superblock included
+    uint32_t flist; // the first block on the free list
+    uint32_t top; // the top chunk, NONE when it is used up
+    uint32_t reserve; // the real-time reserve, see drealtime()
+    uint32_t hint; // where the last insert went, see insert_ordered()
+    uint32_t root; // memory the program finds its data from, see droot()
+    uint32_t busy; // TRUE while a call is changing the heap
+    int32_t free_bytes; // the totals behind dstats()
+    int32_t free_length;
+    int32_t blocks;
+    int32_t largest;
+    uint16_t free_sizes[ARENA / ALIGN + 1]; // see count_free()
+};
+
+// The mapping, superblock first, and the heap file, which is kept open and
+// locked while it is mapped
+struct superblock *super = NULL;
+int heap_fd = -1;
+
+// Every call that changes the heap marks it busy first and ends in leave(),
+// which writes the state of the heap back to the superblock. A heap file that
+// is still busy when it is opened was left half way through a change, see
+// load_heap(). With no heap mapped there is nothing to use.
+int enter()
+{
+    if(super == NULL)
+    {
+        return FALSE;
+    }
+    super->busy = TRUE;
+    return TRUE;
+}
+
+void leave()
+{
+    super->flist = offset_of(flist);
+    super->top = offset_of(top);
+    super->reserve = offset_of(reserve);
+    super->hint = offset_of(hint);
+    super->free_bytes = free_bytes;
+    super->free_length = free_length;
+    super->blocks = blocks;
+    super->largest = largest;
+    super->busy = FALSE;
+}
+
+// Lays out an empty heap in the mapping: the whole arena is the top chunk
+void format()
+{
+    super->magic = HEAP_MAGIC;
+    super->version = HEAP_VERSION;
+    super->size = SUPER + arena_size;
+    super->root = 0;
+    heap_sizes = super->free_sizes;
+    memset(heap_sizes, 0, sizeof(super->free_sizes));
+    lay_out((struct head*) (super + 1));
+    flist = NULL;
+    reserve = NULL;
+    hint = NULL;
+    free_bytes = 0;
+    free_length = 0;
+    largest = 0;
+    leave();
+}
+
+// Takes up a heap which is already in the mapping. One that was left as
+// leave() wrote it has its free list, top chunk and totals in the superblock.
+// One left busy, by a process that died half way through a dalloc() or
+// dfree(), has them made again from the block headers, which are all that is
+// trusted then: their sizes have to lead from the first block to the
+// sentinel. Free blocks it left next to each other are merged, and the sizes
+// of the blocks before are set again from the blocks themselves.
+int load_heap()
+{
+    if(super->magic != HEAP_MAGIC || super->version != HEAP_VERSION || super->size != SUPER + arena_size)
+    {
+        printf("Not a heap file\n");
+        return FALSE;
+    }
+    arena = (struct head*) (super + 1);
+    heap_sizes = super->free_sizes;
+    if(!super->busy)
+    {
+        flist = block_at(super->flist);
+        top = block_at(super->top);
+        reserve = block_at(super->reserve);
+        hint = block_at(super->hint);
+        free_bytes = super->free_bytes;
+        free_length = super->free_length;
+        blocks = super->blocks;
+        largest = super->largest;
+        return TRUE;
+    }
+    struct head *end = arena_end();
+    struct head *current = arena;
+    while(current < end && current->size % ALIGN == 0 && after(current) <= end)
+    {
+        current = after(current);
+    }
+    if(current != end || end->size != 0 || end->free)
+    {
+        printf("The heap file is broken\n");
+        return FALSE;
+    }
+    printf("The heap file was left half way through a change, its free list is made again\n");
+
+    arena->bfree = FALSE;
+    arena->bsize = 0;
+    current = arena;
+    while(current != end)
+    {
+        struct head *next = after(current);
+        while(current->free && next != end && next->free)
+        {
+            current->size = current->size + next->size + HEAD;
+            next = after(current);
+        }
+        next->bfree = current->free;
+        next->bsize = current->size;
+        current = next;
+    }
+
+    flist = NULL;
+    top = NULL;
+    reserve = NULL;
+    hint = NULL;
+    free_bytes = 0;
+    free_length = 0;
+    largest = 0;
+    memset(heap_sizes, 0, sizeof(super->free_sizes));
+    blocks = 1; // the sentinel
+    current = arena;
+    while(current != end)
+    {
+        blocks ++;
+        if(current->free && after(current) == end)
+        {
+            top = current;
+        }
+        else if(current->free)
+        {
+            insert(current);
+        }
+        else if(offset_of(current) == super->reserve)
+        {
+            reserve = current;
+        }
+        current = after(current);
+    }
+    leave();
+    return TRUE;
+}
+
+// An arena of our own, which goes away with the process
+int own_arena()
+{
+    // Using mmap, but we could have also used sbrk
+    struct superblock *mapped = mmap(NULL, SUPER + arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapped == MAP_FAILED)
+    {
+        printf("mmap failed");
+        return FALSE;
+    }
+    super = mapped;
+    format();
+    return TRUE;
+}
+
+// Maps a heap file, or makes a new one with an arena of arena_size bytes if
+// the file is empty or not there. The file stays open and locked until
+// dclose(), and a file another process has open is refused, since the free
+// list is only ever in the mapping of one process. Returns FALSE, with
+// nothing mapped, if the file is not a heap or could not be mapped.
+int dopen(const char *path)
+{
+    if(super != NULL)
+    {
+        printf("One arena already allocated\n");
+        return FALSE;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        printf("Could not open heap file %s\n", path);
+        return FALSE;
+    }
+    if(flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        printf("Heap file %s is open in another process\n", path);
+        close(fd);
+        return FALSE;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        printf("Could not open heap file %s\n", path);
+        close(fd);
+        return FALSE;
+    }
+    int fresh = st.st_size == 0;
+    int size = arena_size;
+    if(fresh && ftruncate(fd, SUPER + size) != 0)
+    {
+        printf("Could not grow heap file %s\n", path);
+        close(fd);
+        return FALSE;
+    }
+    if(!fresh)
+    {
+        if(st.st_size < (off_t) (SUPER + 2*HEAD) || st.st_size > (off_t) (SUPER + ARENA))
+        {
+            printf("%s is not a heap file\n", path);
+            close(fd);
+            return FALSE;
+        }
+        size = st.st_size - SUPER;
+    }
+    struct superblock *mapped = mmap(NULL, SUPER + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapped == MAP_FAILED)
+    {
+        printf("mmap failed");
+        close(fd);
+        return FALSE;
+    }
+    int was = arena_size;
+    super = mapped;
+    arena_size = size;
+    if(fresh)
+    {
+        format();
+    }
+    else if(!load_heap())
+    {
+        munmap(super, SUPER + arena_size);
+        close(fd);
+        super = NULL;
+        heap_sizes = NULL;
+        arena = NULL;
+        arena_size = was;
+        return FALSE;
+    }
+    heap_fd = fd;
+    initiated = TRUE;
+    return TRUE;
+}
+
+// With DALLOC_HEAP set the arena is that heap file. If it cannot be opened
+// the program still gets an arena, one of its own which is not kept.
+void open_heap()
+{
+    char *path = getenv("DALLOC_HEAP");
+    if(path != NULL && dopen(path))
+    {
+        return;
+    }
+    if(path != NULL)
+    {
+        printf("Using an arena that is not kept instead\n");
+    }
+    own_arena();
+}
+
+// Writes the heap out to its file, unmaps it and lets go of the file.
+// dopen() or init() can map a heap again afterwards.
+void dclose()
+{
+    if(super == NULL)
+    {
+        return;
+    }
+    msync(super, SUPER + arena_size, MS_SYNC);
+    munmap(super, SUPER + arena_size);
+    if(heap_fd >= 0)
+    {
+        close(heap_fd);
+        heap_fd = -1;
+    }
+    super = NULL;
+    heap_sizes = NULL;
+    arena = NULL;
+    flist = NULL;
+    top = NULL;
+    reserve = NULL;
+    hint = NULL;
+    free_bytes = 0;
+    free_length = 0;
+    blocks = 0;
+    largest = 0;
+    initiated = FALSE;
+}
+
+// Data in the heap that points at other data in it should keep offsets, which
+// mean the same wherever the heap is mapped, rather than pointers. They are
+// from the start of the file, so that 0 is never memory in the heap and can
+// stand for NULL, as it did before the links in the headers became offsets.
+uint32_t doffset(void *memory)
+{
+    if(memory == NULL)
+    {
+        return 0;
+    }
+    return (char*) memory - (char*) super;
+}
+
+void *dpointer(uint32_t offset)
+{
+    return offset == 0 ? NULL : (char*) super + offset;
+}
+
+// The root is how a program finds its data again after opening the heap.
+// It is whatever memory dset_root() was last given, NULL at first.
+void *droot()
+{
+    if(super == NULL)
+    {
+        return NULL;
+    }
+    return dpointer(super->root);
+}
+
+void dset_root(void *memory)
+{
+    if(super == NULL)
+    {
+        return;
+    }
+    super->root = doffset(memory);
+}
@@ -0,0 +1,19 @@
+#include "../Merge/dlmall.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Heap files, see dopen() in dlmall.c
+int dopen(const char *path);
+void dclose();
+void *droot();
+void dset_root(void *memory);
+uint32_t doffset(void *memory);
+void *dpointer(uint32_t offset);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,84 @@
+#include "engine.hpp"
+
+// The C interface of dlmall.h on one instantiation of the engine in
+// engine.hpp, picked when building:
+//
+//     -DNO_MERGING    no_merging_engine
+//     -DMERGE         merge_engine
+//     (neither)       flists_engine
+//
+// -DLOCKED puts the chosen engine behind a mutex. This file links with the C
+// programs in Bench like the dlmall.c of any other engine:
+//
+//     g++ -O2 -std=c++17 -c -DMERGE -IPolicy Policy/dlmall.cpp
+//     gcc -O2 -IPolicy -IBench Bench/replay.c Bench/perfctr.c Bench/counters.c dlmall.o -lstdc++ -o replay_policy
+
+#if defined(NO_MERGING)
+#define POLICY_COALESCE dlmall::no_merge
+#define POLICY_CLASSES dlmall::no_classes
+#elif defined(MERGE)
+#define POLICY_COALESCE dlmall::merge
+#define POLICY_CLASSES dlmall::no_classes
+#else
+#define POLICY_COALESCE dlmall::merge
+#define POLICY_CLASSES dlmall::geometric_classes<8>
+#endif
+
+#ifdef LOCKED
+#define POLICY_LOCK dlmall::mutex_lock
+#else
+#define POLICY_LOCK dlmall::no_lock
+#endif
+
+typedef dlmall::engine<dlmall::offset_links, POLICY_CLASSES, dlmall::first_fit, POLICY_COALESCE, POLICY_LOCK> heap_engine;
+
+heap_engine heap;
+
+int initiated = dlmall::FALSE;
+void init()
+{
+    if(!initiated)
+    {
+        initiated = dlmall::TRUE;
+        heap.create();
+    }
+}
+
+void *dalloc(size_t request)
+{
+    return heap.dalloc(request);
+}
+
+void dfree(void *memory)
+{
+    heap.dfree(memory);
+}
+
+void drealtime(int limit)
+{
+    heap.realtime(limit);
+}
+
+void sanity()
+{
+    heap.sanity();
+}
+
+void traverse()
+{
+    heap.traverse();
+}
+
+void dstats(struct dstats *out)
+{
+    heap.stats(out);
+}
+
+void dcounters(struct dcounters *out)
+{
+#ifdef DALLOC_COUNTERS
+    *out = dlmall::hot;
+#else
+    memset(out, 0, sizeof(struct dcounters));
+#endif
+}
@@ -0,0 +1,57 @@
+#include <stddef.h>
+
+// Most size classes any of the engines in engine.hpp has, see geometric_classes
+#define CLASSES 64
+
+// Heap statistics filled in by dstats(). The engine keeps these up to date as
+// it goes, so reading them never walks the heap.
+struct dstats
+{
+    size_t in_use; // bytes handed out, not counting headers
+    size_t free; // bytes free, not counting headers
+    size_t top; // bytes in the untouched top chunk, included in free
+    size_t overhead; // bytes taken up by block headers, sentinels included
+    size_t largest_free; // size of the largest free block
+    int blocks; // number of blocks in the arena, sentinels included
+    int lengths[CLASSES + 1]; // length of the general free list, then of each size class list
+    int class_free[CLASSES]; // free blocks the size of each class, on any list
+};
+
+// Buckets for the find() histogram. Requests are grouped by size, up to 8,
+// 16, 32, ... bytes, and searches by how many free list nodes they walked:
+// 0, 1, 2-3, 4-7, ... with the last bucket taking everything longer.
+#define SIZE_BUCKETS 14
+#define WALK_BUCKETS 12
+
+// Hot path counters, only collected when the engine is built with
+// -DDALLOC_COUNTERS, otherwise dcounters() hands back zeros. Every thread
+// counts its own calls.
+struct dcounters
+{
+    long searches; // calls to find()
+    long examined; // free list nodes looked at by find()
+    long failed; // requests find() could not satisfy
+    long splits; // blocks split by split()
+    long merges; // neighbours absorbed by merge()
+    long class_hits[CLASSES]; // requests served from their own size class list
+    long class_fallbacks[CLASSES]; // requests sent to the general list because their class was empty
+    long walks[SIZE_BUCKETS][WALK_BUCKETS]; // searches by request size and nodes walked
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void *dalloc(size_t request);
+void dfree(void *memory);
+void sanity();
+void traverse();
+void init();
+void dstats(struct dstats *out);
+void dcounters(struct dcounters *out);
+void drealtime(int limit);
+
+#ifdef __cplusplus
+}
+#endif
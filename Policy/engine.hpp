@@ -0,0 +1,838 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <array>
+#include <mutex>
+#include <sys/mman.h>
+#include "dlmall.h"
+
+// One engine, put together at compile time from policies, instead of a fork
+// of dlmall.c for every variant:
+//
+//     dlmall::engine<Layout, Classes, Fit, Coalesce, Lock>
+//
+// Layout is the block header and how the free list links are kept in it,
+// Classes the size classes, Fit how the general free list is searched,
+// Coalesce whether freed blocks are merged with their neighbours and Lock what
+// is held around every call. Everything is decided by the types, so there is
+// nothing to look up at run time and the compiler inlines the policies away.
+// no_merging_engine, merge_engine and flists_engine at the bottom lay out and
+// place blocks as the engines in the folders of the same name do, with the
+// same headers, first fit and, for flists_engine, the Flists size classes,
+// which give their free blocks back when a request cannot be met. What the
+// folders have on top of that, the real-time reserve, DALLOC_CONF and the
+// slabs, pools and regions of Flists, is not here. See dlmall.cpp for how one
+// of them is picked for the C interface.
+//
+// Every engine object manages an arena of its own, made by create().
+
+namespace dlmall
+{
+
+// ALIGN is what requests are rounded up to, and ARENA the size of the arena,
+// as in the other engines. CLASSED marks a free block which is kept on a size
+// class list, where merge() must leave it alone.
+constexpr int ALIGN = 8;
+constexpr int ARENA = 64 * 1024;
+constexpr int TRUE = 1;
+constexpr int FALSE = 0;
+constexpr int CLASSED = 2;
+constexpr int IDLE_SHARE = 16;
+
+// Header layouts. Both keep the sizes and status of a block and the block
+// before it in 16 bit fields, and differ in how the free list is linked.
+
+// Raw pointers, 24 byte headers, like the other engines built with
+// -DRELATIVE_LINKS=0
+struct pointer_links
+{
+    struct head
+    {
+        uint16_t bfree; // the status of the block before
+        uint16_t bsize; // the size of the block before
+        uint16_t free; // the status of this block
+        uint16_t size; // the size of this block
+        head *next;
+        head *prev;
+    };
+
+    static head *next(head *block, char *)
+    {
+        return block->next;
+    }
+
+    static head *prev(head *block, char *)
+    {
+        return block->prev;
+    }
+
+    static void set_next(head *block, head *to, char *)
+    {
+        block->next = to;
+    }
+
+    static void set_prev(head *block, head *to, char *)
+    {
+        block->prev = to;
+    }
+};
+
+// Offsets from the start of the arena, 16 byte headers. The links mean the
+// same wherever the arena is mapped. This is what the other engines use.
+struct offset_links
+{
+    static constexpr uint32_t NONE = 0xffffffff;
+
+    struct head
+    {
+        uint16_t bfree;
+        uint16_t bsize;
+        uint16_t free;
+        uint16_t size;
+        uint32_t next;
+        uint32_t prev;
+    };
+
+    static head *at(uint32_t offset, char *base)
+    {
+        return offset == NONE ? nullptr : (head*) (base + offset);
+    }
+
+    static uint32_t offset(head *block, char *base)
+    {
+        return block == nullptr ? NONE : (uint32_t) ((char*) block - base);
+    }
+
+    static head *next(head *block, char *base)
+    {
+        return at(block->next, base);
+    }
+
+    static head *prev(head *block, char *base)
+    {
+        return at(block->prev, base);
+    }
+
+    static void set_next(head *block, head *to, char *base)
+    {
+        block->next = offset(to, base);
+    }
+
+    static void set_prev(head *block, head *to, char *base)
+    {
+        block->prev = offset(to, base);
+    }
+};
+
+// Size classes. of() gives the class of a request which has already been
+// rounded up to ALIGN, 0 if it has none, size() the size of a class and
+// capacity() how many free blocks its list keeps before they go back to the
+// general list. All the classes together keep no more than an IDLE_SHARE:th
+// of the arena, as in Flists, see engine::dfree().
+
+struct no_classes
+{
+    static constexpr int count = 0;
+
+    static constexpr int of(int)
+    {
+        return 0;
+    }
+
+    static constexpr int size(int)
+    {
+        return 0;
+    }
+
+    static constexpr int capacity(int)
+    {
+        return 0;
+    }
+};
+
+// Count classes, Step bytes apart, the way Flists started out
+template<int Step, int Count, int Capacity>
+struct linear_classes
+{
+    static_assert(Step % ALIGN == 0, "classes must be multiples of ALIGN");
+    static constexpr int count = Count;
+
+    static constexpr int of(int size)
+    {
+        return size <= Step * Count ? (size + Step - 1) / Step : 0;
+    }
+
+    static constexpr int size(int c)
+    {
+        return c * Step;
+    }
+
+    static constexpr int capacity(int)
+    {
+        return Capacity;
+    }
+};
+
+// 8 to 128 bytes in steps of 8 and then eight classes to every doubling up to
+// 8 kbytes, as Flists has by default. Both ways between sizes and classes are
+// tables worked out by the compiler. The classes above 128 bytes keep no more
+// than SPAN bytes of free blocks each.
+template<int Capacity>
+struct geometric_classes
+{
+    static constexpr int count = 64;
+    static constexpr int LARGEST = 8192;
+    static constexpr int SMALL = 128;
+    static constexpr int SPAN = 1024;
+
+    struct tables
+    {
+        std::array<uint16_t, count + 1> sizes;
+        std::array<uint8_t, LARGEST / ALIGN + 1> classes;
+    };
+
+    static constexpr tables make()
+    {
+        tables t{};
+        int c = 0;
+        for(c = 1; c <= count; c ++)
+        {
+            if(c <= SMALL / 8)
+            {
+                t.sizes[c] = c * 8;
+            }
+            else
+            {
+                int base = SMALL << ((c - SMALL / 8 - 1) / 8);
+                t.sizes[c] = base + base / 8 * ((c - SMALL / 8 - 1) % 8 + 1);
+            }
+        }
+        c = 1;
+        int i = 0;
+        for(i = 1; i <= LARGEST / ALIGN; i ++)
+        {
+            while(t.sizes[c] < i * ALIGN)
+            {
+                c ++;
+            }
+            t.classes[i] = c;
+        }
+        return t;
+    }
+
+    static constexpr tables table = make();
+
+    static constexpr int of(int size)
+    {
+        return size <= LARGEST ? table.classes[size / ALIGN] : 0;
+    }
+
+    static constexpr int size(int c)
+    {
+        return table.sizes[c];
+    }
+
+    static constexpr int capacity(int c)
+    {
+        return size(c) <= SMALL ? Capacity : (SPAN / size(c) > 1 ? SPAN / size(c) : 1);
+    }
+};
+
+static_assert(geometric_classes<8>::size(64) == 8192, "geometric classes end at 8 kbytes");
+static_assert(geometric_classes<8>::of(136) == 17, "the first class above 128 bytes is 144");
+
+// Fit policies search the general free list for a block of at least size
+// bytes, looking at no more than limit blocks when limit is not 0. walked is
+// set to the number looked at.
+
+// The first block that is big enough
+struct first_fit
+{
+    template<typename Links, typename Head>
+    static Head *find(Head *list, int size, int limit, char *base, int *walked)
+    {
+        Head *current = list;
+        *walked = 0;
+        while(current != nullptr && (limit == 0 || *walked < limit))
+        {
+            (*walked) ++;
+            if(current->size >= size)
+            {
+                return current;
+            }
+            current = Links::next(current, base);
+        }
+        return nullptr;
+    }
+};
+
+// The smallest block that is big enough, stopping early on an exact fit
+struct best_fit
+{
+    template<typename Links, typename Head>
+    static Head *find(Head *list, int size, int limit, char *base, int *walked)
+    {
+        Head *best = nullptr;
+        Head *current = list;
+        *walked = 0;
+        while(current != nullptr && (limit == 0 || *walked < limit))
+        {
+            (*walked) ++;
+            if(current->size >= size && (best == nullptr || current->size < best->size))
+            {
+                best = current;
+                if(current->size == size)
+                {
+                    break;
+                }
+            }
+            current = Links::next(current, base);
+        }
+        return best;
+    }
+};
+
+// Coalescing policies. Without merging the whole arena starts out on the free
+// list and freed blocks go straight back on it, as in No_Merging. With
+// merging, freed blocks take in their free neighbours and the end of the arena
+// is a top chunk which blocks are cut off the front of, as in Merge.
+struct no_merge
+{
+    static constexpr bool merges = false;
+};
+
+struct merge
+{
+    static constexpr bool merges = true;
+};
+
+// Locking policies, anything with lock() and unlock(). std::mutex makes an
+// engine safe to share between threads.
+struct no_lock
+{
+    void lock()
+    {
+    }
+
+    void unlock()
+    {
+    }
+};
+
+typedef std::mutex mutex_lock;
+
+// Hot path counters, see dcounters(). They compile to nothing unless the
+// engine is built with -DDALLOC_COUNTERS.
+#ifdef DALLOC_COUNTERS
+inline thread_local struct dcounters hot;
+#define COUNT(field) (dlmall::hot.field ++)
+#define WALKED(size, n) (dlmall::hot.examined += (n), dlmall::hot.walks[size_bucket(size)][walk_bucket(n)] ++)
+#else
+#define COUNT(field)
+#define WALKED(size, n) ((void) (n))
+#endif
+
+// Histogram buckets, see SIZE_BUCKETS and WALK_BUCKETS
+inline int size_bucket(int size)
+{
+    int i = 0;
+    while(i < SIZE_BUCKETS - 1 && size > (8 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+inline int walk_bucket(int walked)
+{
+    int i = 0;
+    while(i < WALK_BUCKETS - 1 && walked >= (1 << i))
+    {
+        i ++;
+    }
+    return i;
+}
+
+template<typename Layout, typename Classes, typename Fit, typename Coalesce, typename Lock>
+class engine
+{
+public:
+    typedef typename Layout::head head;
+    static constexpr int HEAD = sizeof(head);
+
+    static_assert(HEAD % ALIGN == 0, "the header must keep blocks aligned");
+    static_assert(Classes::count <= CLASSES, "dstats() has room for CLASSES classes");
+
+    // Maps the arena, which starts out as one free block, or the top chunk
+    // when merging, followed by a sentinel
+    bool create()
+    {
+        if(base != nullptr)
+        {
+            printf("One arena already allocated\n");
+            return false;
+        }
+        void *memory = mmap(NULL, ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory == MAP_FAILED)
+        {
+            printf("mmap failed");
+            return false;
+        }
+        base = (char*) memory;
+
+        int size = ARENA - 2 * HEAD;
+        head *first = (head*) base;
+        first->bfree = FALSE;
+        first->bsize = 0;
+        first->free = TRUE;
+        first->size = size;
+
+        head *sentinel = after(first);
+        sentinel->bfree = TRUE;
+        sentinel->bsize = size;
+        sentinel->free = FALSE;
+        sentinel->size = 0;
+        blocks = 2;
+
+        if constexpr(Coalesce::merges)
+        {
+            top = first;
+        }
+        else
+        {
+            insert(first);
+        }
+        return true;
+    }
+
+    void *dalloc(size_t request)
+    {
+        if(request <= 0)
+        {
+            printf("Invalid Dalloc Request");
+            return NULL;
+        }
+        if(request > ARENA)
+        {
+            return NULL;
+        }
+        std::lock_guard<Lock> guard(lock);
+        int size = adjust(request);
+        int c = Classes::of(size);
+        if(c != 0)
+        {
+            size = Classes::size(c);
+            if(class_lists[c] != nullptr)
+            {
+                COUNT(class_hits[c - 1]);
+                head *taken = class_lists[c];
+                detach(taken, c);
+                taken->free = FALSE;
+                return taken + 1;
+            }
+            COUNT(class_fallbacks[c - 1]);
+        }
+        head *taken = find(size);
+        if constexpr(Coalesce::merges)
+        {
+            if(taken == nullptr)
+            {
+                taken = from_top(size);
+            }
+        }
+        // The free blocks the classes keep may be all that is left, merged
+        // back together they can serve this request
+        if(taken == nullptr && walk_limit == 0 && reclaim())
+        {
+            taken = find(size);
+            if constexpr(Coalesce::merges)
+            {
+                if(taken == nullptr)
+                {
+                    taken = from_top(size);
+                }
+            }
+        }
+        if(taken == nullptr)
+        {
+            return NULL;
+        }
+        return taken + 1;
+    }
+
+    void dfree(void *memory)
+    {
+        if(memory == NULL)
+        {
+            return;
+        }
+        std::lock_guard<Lock> guard(lock);
+        head *block = (head*) memory - 1;
+
+        // A block the size of a class goes on its list while there is room,
+        // without being merged, so that it can be handed out again as it is
+        int c = Classes::of(block->size);
+        if(c != 0 && Classes::size(c) == block->size && class_lengths[c] < Classes::capacity(c) && class_bytes + block->size + HEAD <= ARENA / IDLE_SHARE)
+        {
+            block->free = CLASSED;
+            insert(block, c);
+            return;
+        }
+        give_back(block);
+    }
+
+    // Turns real-time mode on or off, see drealtime() in the other engines.
+    // A search cut short fails over to the top chunk, there is no reserve.
+    void realtime(int limit)
+    {
+        std::lock_guard<Lock> guard(lock);
+        walk_limit = limit > 0 ? limit : 0;
+    }
+
+    void stats(struct dstats *out)
+    {
+        std::lock_guard<Lock> guard(lock);
+        // Bring the largest size down to a block that is still free
+        while(largest > 0 && free_sizes[largest / ALIGN] == 0)
+        {
+            largest = largest - ALIGN;
+        }
+
+        memset(out, 0, sizeof(struct dstats));
+        if(top != nullptr)
+        {
+            out->top = top->size;
+        }
+        out->free = free_bytes + out->top;
+        out->overhead = blocks * HEAD;
+        out->in_use = ARENA - out->overhead - out->free;
+        out->largest_free = largest;
+        if(out->top > out->largest_free)
+        {
+            out->largest_free = out->top;
+        }
+        out->blocks = blocks;
+        int c;
+        for(c = 0; c <= Classes::count; c ++)
+        {
+            out->lengths[c] = class_lengths[c];
+        }
+        for(c = 0; c < CLASSES; c ++)
+        {
+            if(Classes::count == 0 && (c + 1) * 8 <= ARENA)
+            {
+                out->class_free[c] = free_sizes[(c + 1) * 8 / ALIGN];
+            }
+            else if(c < Classes::count)
+            {
+                out->class_free[c] = free_sizes[Classes::size(c + 1) / ALIGN];
+            }
+        }
+    }
+
+    // Prints every block on the free lists, see sanity() in the other engines
+    void sanity()
+    {
+        int length = 0;
+        int acc_size = 0;
+        int c;
+        for(c = 0; c <= Classes::count; c ++)
+        {
+            head *current = class_lists[c];
+            while(current != nullptr)
+            {
+                printf("I am: %p\n", (void*) current);
+                printf("flist node free? expected result 1 or %d: %d\n", CLASSED, current->free);
+                printf("flist node is divisible size? expected result 0: %d\n", current->size % ALIGN);
+                printf("node prev: %p\n", (void*) prev(current));
+                printf("node next: %p\n", (void*) next(current));
+                printf("My size is %d\n", current->size);
+                printf("\n");
+                acc_size = acc_size + current->size;
+                current = next(current);
+                length ++;
+            }
+        }
+        printf("Length of the free lists: %d\n", length);
+        printf("Total size of free list nodes: %d\n", acc_size);
+        if(length > 0)
+        {
+            printf("Average size of free list nodes: %d\n", acc_size / length);
+        }
+    }
+
+    void traverse()
+    {
+        head *current = (head*) base;
+        char *end = base + ARENA;
+        while((char*) current < end)
+        {
+            printf("I am: %p\n", (void*) current);
+            printf("memory node free? 1 is free, 0 is not free: %d\n", current->free);
+            printf("memory node is divisible size? expected result 0: %d\n", current->size % ALIGN);
+            printf("My memory size is : %d\n", current->size);
+            printf("The previous memory size is : %d\n", current->bsize);
+            printf("prev in memory: %p\n", (void*) before(current));
+            printf("next in memory: %p\n", (void*) after(current));
+            printf("\n");
+            current = after(current);
+        }
+    }
+
+private:
+    char *base = nullptr;
+    Lock lock;
+
+    // class_lists[0] is the general free list, the rest one per size class
+    head *class_lists[Classes::count + 1] = {};
+    int class_lengths[Classes::count + 1] = {};
+    head *top = nullptr;
+    int walk_limit = 0;
+
+    // Running totals behind stats(), as in the other engines
+    int free_bytes = 0;
+    int class_bytes = 0; // bytes in free blocks on the class lists, headers included
+    int blocks = 0;
+    uint16_t free_sizes[ARENA / ALIGN + 1] = {};
+    int largest = 0; // never smaller than the largest free block
+
+    head *next(head *block)
+    {
+        return Layout::next(block, base);
+    }
+
+    head *prev(head *block)
+    {
+        return Layout::prev(block, base);
+    }
+
+    head *after(head *block)
+    {
+        return (head*) ((char*) block + HEAD + block->size);
+    }
+
+    head *before(head *block)
+    {
+        return (head*) ((char*) block - HEAD - block->bsize);
+    }
+
+    head *arena_end()
+    {
+        return (head*) (base + ARENA - HEAD);
+    }
+
+    void count_free(head *block, int change)
+    {
+        free_bytes = free_bytes + change * block->size;
+        free_sizes[block->size / ALIGN] += change;
+        if(change > 0 && block->size > largest)
+        {
+            largest = block->size;
+        }
+    }
+
+    void insert(head *block, int c = 0)
+    {
+        count_free(block, 1);
+        class_lengths[c] ++;
+        if(c != 0)
+        {
+            class_bytes = class_bytes + block->size + HEAD;
+        }
+        Layout::set_prev(block, nullptr, base);
+        Layout::set_next(block, class_lists[c], base);
+        if(class_lists[c] != nullptr)
+        {
+            Layout::set_prev(class_lists[c], block, base);
+        }
+        class_lists[c] = block;
+    }
+
+    void detach(head *block, int c = 0)
+    {
+        count_free(block, -1);
+        class_lengths[c] --;
+        if(c != 0)
+        {
+            class_bytes = class_bytes - (block->size + HEAD);
+        }
+        head *n = next(block);
+        head *p = prev(block);
+        if(n != nullptr)
+        {
+            Layout::set_prev(n, p, base);
+        }
+        if(p != nullptr)
+        {
+            Layout::set_next(p, n, base);
+        }
+        else
+        {
+            class_lists[c] = n;
+        }
+    }
+
+    int adjust(size_t request)
+    {
+        int size = (request + ALIGN - 1) / ALIGN * ALIGN;
+        return size > 8 ? size : 8;
+    }
+
+    // Cuts size bytes off the back of a free block, which keeps its place on
+    // the list with what is left of it
+    head *split(head *block, int size)
+    {
+        count_free(block, -1);
+        block->size = block->size - (size + HEAD);
+        count_free(block, 1);
+
+        head *taken = after(block);
+        taken->bsize = block->size;
+        taken->bfree = TRUE;
+        taken->size = size;
+        taken->free = FALSE;
+        after(taken)->bsize = size;
+        after(taken)->bfree = FALSE;
+        blocks ++;
+        COUNT(splits);
+        return taken;
+    }
+
+    head *find(int size)
+    {
+        COUNT(searches);
+        if(class_lists[0] == nullptr || size > largest)
+        {
+            WALKED(size, 0);
+            COUNT(failed);
+            return nullptr;
+        }
+        int walked;
+        head *found = Fit::template find<Layout>(class_lists[0], size, walk_limit, base, &walked);
+        WALKED(size, walked);
+        if(found == nullptr)
+        {
+            COUNT(failed);
+            return nullptr;
+        }
+        if(found->size >= size + HEAD + 8)
+        {
+            return split(found, size);
+        }
+        detach(found);
+        found->free = FALSE;
+        after(found)->bfree = FALSE;
+        return found;
+    }
+
+    // Takes a block off the front of the top chunk
+    head *from_top(int size)
+    {
+        if(top == nullptr || top->size < size)
+        {
+            return nullptr;
+        }
+        head *taken = top;
+        if(top->size >= size + HEAD + 8)
+        {
+            int rest = top->size - (size + HEAD);
+            taken->size = size;
+            top = after(taken);
+            top->bfree = FALSE;
+            top->bsize = size;
+            top->free = TRUE;
+            top->size = rest;
+            after(top)->bsize = rest;
+            blocks ++;
+        }
+        else
+        {
+            top = nullptr;
+            after(taken)->bfree = FALSE;
+        }
+        taken->free = FALSE;
+        return taken;
+    }
+
+    // Gives a merged free block back to the top chunk
+    void to_top(head *block)
+    {
+        if(top != nullptr)
+        {
+            block->size = block->size + top->size + HEAD;
+            blocks --;
+        }
+        top = block;
+        after(top)->bsize = top->size;
+        after(top)->bfree = TRUE;
+    }
+
+    // Takes in the free neighbours of a block, but not blocks kept on a size
+    // class list, nor the top chunk, which to_top() deals with
+    head *merge(head *block)
+    {
+        head *aft = after(block);
+        if(block->bfree && before(block)->free == TRUE)
+        {
+            head *bef = before(block);
+            detach(bef);
+            bef->size = bef->size + block->size + HEAD;
+            aft->bsize = bef->size;
+            blocks --;
+            COUNT(merges);
+            block = bef;
+        }
+        if(aft->free == TRUE && aft != top)
+        {
+            detach(aft);
+            block->size = block->size + aft->size + HEAD;
+            after(aft)->bsize = block->size;
+            blocks --;
+            COUNT(merges);
+        }
+        after(block)->bfree = TRUE;
+        return block;
+    }
+
+    // Puts a block on the general list, merged with its free neighbours
+    void give_back(head *block)
+    {
+        block->free = TRUE;
+        if constexpr(Coalesce::merges)
+        {
+            block = merge(block);
+            if(after(block) == top || after(block) == arena_end())
+            {
+                to_top(block);
+                return;
+            }
+        }
+        insert(block);
+    }
+
+    // Gives every block the class lists keep back to the general list, see
+    // reclaim() in Flists. Returns false if there were none.
+    bool reclaim()
+    {
+        bool given = false;
+        int c;
+        for(c = 1; c <= Classes::count; c ++)
+        {
+            while(class_lists[c] != nullptr)
+            {
+                head *block = class_lists[c];
+                detach(block, c);
+                give_back(block);
+                given = true;
+            }
+        }
+        return given;
+    }
+};
+
+typedef engine<offset_links, no_classes, first_fit, no_merge, no_lock> no_merging_engine;
+typedef engine<offset_links, no_classes, first_fit, merge, no_lock> merge_engine;
+typedef engine<offset_links, geometric_classes<8>, first_fit, merge, no_lock> flists_engine;
+
+}
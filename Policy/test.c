@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "dlmall.h"
+
+#define REQ_UPPER 5 // upper number of dalloc requests/frees at once
+#define REQ_LOWER 1 // lower number of dalloc requests/frees at once
+
+void test1(int upper)
+{
+    // first request will always work
+    srand(time(NULL));
+    int i = 1;
+    int randomnumber;
+    randomnumber = (rand() % upper) + 1;
+
+    struct head *alloc = dalloc(randomnumber);
+    printf("%d SUCCESS: %d bytes allocated. %p\n",i, randomnumber, alloc);
+    i++;
+    while(alloc != NULL)
+    {
+        randomnumber = (rand() % upper) + 1;
+        alloc = dalloc(randomnumber);
+        if(alloc != NULL)
+        {
+            printf("%d SUCCESS: %d bytes allocated. %p\n",i, randomnumber, alloc);
+            i++;
+        }
+        else
+        {
+            printf("%d FAILURE\n", i);
+            i++;
+        }
+    }
+}
+
+void test2(volatile int loops, int av)
+{
+    // let's use 100 indices
+    struct head* procs[100]; 
+    int i;
+    for (i = 0; i < 100; i ++)
+    {
+        procs[i] = NULL;
+    }
+
+    int j = 0;
+
+    srand(time(NULL));
+    while(loops > 0)
+    { 
+        int randomnumber;
+        //printf("%d ", loops);
+        randomnumber = (rand() % 100);
+
+        if(procs[randomnumber] == NULL)
+        {
+            
+            int randalloc;
+            randalloc = (rand() % av) + 1;
+            struct head *temp = dalloc(randalloc);
+            if(temp == NULL)
+            {
+                //printf("MALLOC FAILED");
+                j ++;
+            }
+            else
+            {
+                procs[randomnumber] = temp;
+            }
+        }
+        else
+        {
+            struct head *temp = procs[randomnumber];
+            if(temp != NULL)
+            {
+                dfree(temp);
+            }
+            procs[randomnumber] = NULL;
+        }
+        loops --;
+    }
+
+    printf("I failed this much: %d. ", j);
+
+    //sanity();
+    
+
+}
+
+// Fills the arena, frees it all in a random order and asks for a block bigger
+// than any of those. Built with -DNO_MERGING, as dlmall.cpp was, only the
+// freed sizes can be served again, since that engine never merges.
+void test3()
+{
+    struct head *procs[1000];
+    int sizes[1000];
+    int n = 0;
+    srand(time(NULL));
+    while(n < 1000)
+    {
+        sizes[n] = (rand() % 1000) + 1;
+        struct head *temp = dalloc(sizes[n]);
+        if(temp == NULL)
+        {
+            break;
+        }
+        procs[n] = temp;
+        n ++;
+    }
+
+    int i;
+    for(i = n - 1; i > 0; i --)
+    {
+        int j = rand() % (i + 1);
+        struct head *temp = procs[i];
+        procs[i] = procs[j];
+        procs[j] = temp;
+    }
+    for(i = 0; i < n; i ++)
+    {
+        dfree(procs[i]);
+    }
+
+#ifdef NO_MERGING
+    int large = sizes[0];
+#else
+    int large = 16 * 1024;
+#endif
+    struct dstats stats;
+    dstats(&stats);
+    struct head *temp = dalloc(large);
+    if(stats.in_use == 0 && temp != NULL)
+    {
+        printf("Freed %d blocks and got %d bytes back. ", n, large);
+    }
+    else
+    {
+        printf("FAILED: %d blocks freed, %zu bytes still in use, %d bytes %s. ", n, stats.in_use, large, temp == NULL ? "not served" : "served");
+    }
+    dfree(temp);
+}
+
+int main()
+{
+    // Initialise our program memory
+    init();
+
+    test3();
+
+    // Perform tests as appropriate, e.g.
+    clock_t start, end;
+    double cpu_time_used;
+
+    start = clock();
+    test2(100000000,100);
+    end = clock();
+    cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
+
+    printf("I took: %f", cpu_time_used);
+
+    return 0;
+}
\ No newline at end of file
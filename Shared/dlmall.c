@@ -0,0 +1,517 @@
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// The Merge engine on an arena that several processes share. The arena is a
+// shared memory object, see dshared_open() and dshared_map(), which every
+// process maps at an address of its own, so the free list links in the
+// headers are offsets from the start of the arena rather than pointers. A
+// superblock in front of the arena keeps the free list, the top chunk, the
+// totals behind dstats() and a process-shared lock, which every call holds
+// while it works on the heap. dalloc_shared() and dfree_shared() put a small
+// cache in front of dalloc() and dfree() which does without the lock.
+
+// Everything but the sharing is the Merge engine, which is included below.
+// The hooks it leaves, see the top of Merge/dlmall.c, take the lock around
+// every call, keep the counts of free blocks of each size in the superblock
+// and map the shared heap when the program starts.
+#undef RELATIVE_LINKS
+#define RELATIVE_LINKS 1
+#define ENTER() enter()
+#define LEAVE() leave()
+#define OPEN_ARENA() open_heap()
+#define FREE_SIZES shared_sizes
+
+int enter();
+void leave();
+void open_heap();
+uint16_t *shared_sizes = NULL; // free_sizes[] in the superblock
+
+#include "../Merge/dlmall.c"
+
+// HEAP_MAGIC and HEAP_VERSION tell a shared heap from anything else
+#define SUPER (sizeof(struct superblock))
+#define HEAP_MAGIC 0x48414c44
+#define HEAP_VERSION 2
+
+// The start of the shared heap, the arena follows it. The blocks in it are
+// offsets from the start of the arena, as the links in the headers are, and
+// the root one from the start of the heap, as doffset() gives.
+struct superblock
+{
+    uint32_t magic; // HEAP_MAGIC, once the heap is ready
+    uint32_t version; // HEAP_VERSION
+    uint32_t size; // bytes in the heap, superblock included
+    uint32_t flist; // the first block on the free list
+    uint32_t top; // the top chunk, NONE when it is used up
+    uint32_t reserve; // the real-time reserve, see drealtime()
+    uint32_t hint; // where the last insert went, see insert_ordered()
+    uint32_t root; // memory the processes find their data from, see droot()
+    uint32_t busy; // TRUE while a call is changing the heap
+    int32_t free_bytes; // the totals behind dstats()
+    int32_t free_length;
+    int32_t blocks;
+    int32_t largest;
+    pthread_mutex_t lock; // held by every call, see enter()
+    uint16_t free_sizes[ARENA / ALIGN + 1]; // see count_free()
+};
+
+// The mapping, superblock first
+struct superblock *super = NULL;
+
+// Every call that looks at or changes the heap holds the lock in the
+// superblock. enter() takes it and picks up the state of the heap as the last
+// process left it, leave() writes the state back and lets go. The heap is
+// marked busy in between, so when a process dies half way through a change
+// the next one to take the lock finds out from the busy flag, and makes the
+// free list again from the block headers before using the heap, see
+// rebuild(). If the headers do not add up either the lock is left
+// unrecoverable and every process stops using the heap. enter() returns
+// FALSE when that has happened, or when no heap is mapped.
+int broken = FALSE;
+
+void save()
+{
+    super->flist = offset_of(flist);
+    super->top = offset_of(top);
+    super->reserve = offset_of(reserve);
+    super->hint = offset_of(hint);
+    super->free_bytes = free_bytes;
+    super->free_length = free_length;
+    super->blocks = blocks;
+    super->largest = largest;
+    super->busy = FALSE;
+}
+
+int rebuild();
+
+int enter()
+{
+    if(super == NULL)
+    {
+        return FALSE;
+    }
+    int locked = pthread_mutex_lock(&super->lock);
+    if(locked == EOWNERDEAD)
+    {
+        // Left unrecoverable if the heap cannot be made again, since nobody
+        // else should use it then
+        if(super->busy && !rebuild())
+        {
+            broken = TRUE;
+            pthread_mutex_unlock(&super->lock);
+            return FALSE;
+        }
+        pthread_mutex_consistent(&super->lock);
+    }
+    else if(locked != 0)
+    {
+        if(!broken)
+        {
+            printf("The shared heap was left broken by a process that died\n");
+        }
+        broken = TRUE;
+        return FALSE;
+    }
+    if(super->busy)
+    {
+        if(!broken)
+        {
+            printf("The shared heap was left half way through a change\n");
+        }
+        broken = TRUE;
+        pthread_mutex_unlock(&super->lock);
+        return FALSE;
+    }
+    super->busy = TRUE;
+    flist = block_at(super->flist);
+    top = block_at(super->top);
+    reserve = block_at(super->reserve);
+    hint = block_at(super->hint);
+    free_bytes = super->free_bytes;
+    free_length = super->free_length;
+    blocks = super->blocks;
+    largest = super->largest;
+    return TRUE;
+}
+
+void leave()
+{
+    save();
+    pthread_mutex_unlock(&super->lock);
+}
+
+// Makes the free list, the top chunk and the totals again from the block
+// headers, which the process that died was part way through changing. Their
+// sizes have to lead from the first block to the sentinel. Free blocks left
+// next to each other are merged, and the sizes of the blocks before are set
+// again from the blocks themselves. Blocks in the caches of the process that
+// died stay allocated.
+int rebuild()
+{
+    printf("The shared heap was left half way through a change, its free list is made again\n");
+    struct head *end = arena_end();
+    struct head *current = arena;
+    while(current < end && current->size % ALIGN == 0 && after(current) <= end)
+    {
+        current = after(current);
+    }
+    if(current != end || end->size != 0 || end->free)
+    {
+        printf("The shared heap is broken\n");
+        return FALSE;
+    }
+
+    arena->bfree = FALSE;
+    arena->bsize = 0;
+    current = arena;
+    while(current != end)
+    {
+        struct head *next = after(current);
+        while(current->free && next != end && next->free)
+        {
+            current->size = current->size + next->size + HEAD;
+            next = after(current);
+        }
+        next->bfree = current->free;
+        next->bsize = current->size;
+        current = next;
+    }
+
+    struct head *kept = block_at(super->reserve);
+    flist = NULL;
+    top = NULL;
+    reserve = NULL;
+    hint = NULL;
+    free_bytes = 0;
+    free_length = 0;
+    largest = 0;
+    memset(super->free_sizes, 0, sizeof(super->free_sizes));
+    blocks = 1; // the sentinel
+    current = arena;
+    while(current != end)
+    {
+        blocks ++;
+        if(current->free && after(current) == end)
+        {
+            top = current;
+        }
+        else if(current->free)
+        {
+            insert(current);
+        }
+        else if(current == kept)
+        {
+            reserve = current;
+        }
+        current = after(current);
+    }
+    save();
+    return TRUE;
+}
+
+// Lays out an empty heap in a new mapping, the whole arena as the top chunk.
+// The magic number is written last, other processes wait for it before they
+// use the heap.
+void format()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&super->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    super->version = HEAP_VERSION;
+    super->size = SUPER + arena_size;
+    super->root = 0;
+    super->busy = TRUE;
+    memset(super->free_sizes, 0, sizeof(super->free_sizes));
+
+    lay_out((struct head*) (super + 1));
+    flist = NULL;
+    reserve = NULL;
+    hint = NULL;
+    free_bytes = 0;
+    free_length = 0;
+    largest = 0;
+    pthread_mutex_lock(&super->lock);
+    leave();
+    __atomic_store_n(&super->magic, HEAP_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Takes up a heap another process has made, once it is ready
+int attach()
+{
+    int waited = 0;
+    while(__atomic_load_n(&super->magic, __ATOMIC_ACQUIRE) != HEAP_MAGIC && waited < 1000)
+    {
+        usleep(1000);
+        waited ++;
+    }
+    if(super->magic != HEAP_MAGIC || super->version != HEAP_VERSION || super->size != SUPER + arena_size)
+    {
+        printf("Not a shared heap\n");
+        return FALSE;
+    }
+    arena = (struct head*) (super + 1);
+    return TRUE;
+}
+
+void forget_cache();
+
+// Maps size bytes of fd, or an anonymous mapping for -1, which is shared with
+// the children the process forks afterwards. The heap is laid out if fresh is
+// TRUE, otherwise it is one another process has laid out. Returns FALSE, with
+// nothing mapped, if that fails.
+int map_heap(int fd, int size, int fresh)
+{
+    if(super != NULL)
+    {
+        printf("One arena already allocated\n");
+        return FALSE;
+    }
+    int flags = fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED;
+    struct superblock *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(mapped == MAP_FAILED)
+    {
+        printf("mmap failed");
+        return FALSE;
+    }
+    int was = arena_size;
+    super = mapped;
+    shared_sizes = super->free_sizes;
+    arena_size = size - SUPER;
+    if(fresh)
+    {
+        format();
+    }
+    else if(!attach())
+    {
+        munmap(super, size);
+        super = NULL;
+        shared_sizes = NULL;
+        arena = NULL;
+        arena_size = was;
+        return FALSE;
+    }
+    // A child has the same caches as its parent at first, and must not hand
+    // out the same blocks
+    static int registered = FALSE;
+    if(!registered)
+    {
+        registered = TRUE;
+        pthread_atfork(NULL, NULL, forget_cache);
+    }
+    initiated = TRUE;
+    return TRUE;
+}
+
+// Opens the shared heap of the given name, see shm_open(), making it if it is
+// not there yet. Every process that opens the same name shares the heap.
+int dshared_open(const char *name)
+{
+    int fresh = TRUE;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 && errno == EEXIST)
+    {
+        fresh = FALSE;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if(fd < 0)
+    {
+        printf("Could not open shared heap %s\n", name);
+        return FALSE;
+    }
+    int size = SUPER + arena_size;
+    if(fresh && ftruncate(fd, size) != 0)
+    {
+        printf("Could not size shared heap %s\n", name);
+        close(fd);
+        shm_unlink(name);
+        return FALSE;
+    }
+    if(!fresh)
+    {
+        // The process making it may not have sized it yet
+        struct stat st;
+        int waited = 0;
+        while((fstat(fd, &st) != 0 || st.st_size == 0) && waited < 1000)
+        {
+            usleep(1000);
+            waited ++;
+        }
+        if(st.st_size < (off_t) (SUPER + 2*HEAD) || st.st_size > (off_t) (SUPER + ARENA))
+        {
+            printf("%s is not a shared heap\n", name);
+            close(fd);
+            return FALSE;
+        }
+        size = st.st_size;
+    }
+    int mapped = map_heap(fd, size, fresh);
+    close(fd);
+    return mapped;
+}
+
+// Maps a shared heap from a file descriptor, such as one from memfd_create()
+// which is handed to other processes by fork() or over a unix socket. An
+// empty one is sized and laid out, so the process that made it should map
+// it before passing it on.
+int dshared_map(int fd)
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        printf("Could not map shared heap\n");
+        return FALSE;
+    }
+    if(st.st_size == 0)
+    {
+        if(ftruncate(fd, SUPER + arena_size) != 0)
+        {
+            printf("Could not size shared heap\n");
+            return FALSE;
+        }
+        return map_heap(fd, SUPER + arena_size, TRUE);
+    }
+    if(st.st_size < (off_t) (SUPER + 2*HEAD) || st.st_size > (off_t) (SUPER + ARENA))
+    {
+        printf("Not a shared heap\n");
+        return FALSE;
+    }
+    return map_heap(fd, st.st_size, FALSE);
+}
+
+// With DALLOC_SHM set the arena is the shared heap of that name, see
+// dshared_open(). Otherwise, or if that cannot be opened, it is shared with
+// the children of the process.
+void open_heap()
+{
+    char *name = getenv("DALLOC_SHM");
+    if(name != NULL && dshared_open(name))
+    {
+        return;
+    }
+    if(name != NULL)
+    {
+        printf("Using a heap shared with the children of the process instead\n");
+    }
+    map_heap(-1, SUPER + arena_size, TRUE);
+}
+
+// Data in the heap that points at other data in it must keep offsets, since
+// every process has the heap mapped at an address of its own. They are from
+// the start of the heap, so that 0 is never memory in it and can stand for
+// NULL.
+uint32_t doffset(void *memory)
+{
+    if(memory == NULL)
+    {
+        return 0;
+    }
+    return (char*) memory - (char*) super;
+}
+
+void *dpointer(uint32_t offset)
+{
+    return offset == 0 ? NULL : (char*) super + offset;
+}
+
+// The root is how a process finds the data others have left in the heap.
+// It is whatever memory dset_root() was last given, NULL at first.
+void *droot()
+{
+    if(super == NULL)
+    {
+        return NULL;
+    }
+    return dpointer(__atomic_load_n(&super->root, __ATOMIC_ACQUIRE));
+}
+
+void dset_root(void *memory)
+{
+    if(super == NULL)
+    {
+        return;
+    }
+    __atomic_store_n(&super->root, doffset(memory), __ATOMIC_RELEASE);
+}
+
+// Per thread caches. A small block given back with dfree_shared() is kept by
+// the thread for its next dalloc_shared() of the same size, which takes it
+// without going near the lock. Cached blocks are still allocated as far as
+// the heap is concerned; dshared_flush() gives them back.
+#define CACHE_MAX 128
+#define CACHE_SIZE 16
+
+__thread struct head *cache[CACHE_MAX / ALIGN + 1][CACHE_SIZE];
+__thread int cached[CACHE_MAX / ALIGN + 1];
+
+void forget_cache()
+{
+    memset(cached, 0, sizeof(cached));
+}
+
+void *dalloc_shared(size_t request)
+{
+    if(request > 0 && request <= CACHE_MAX)
+    {
+        int c = adjust(request) / ALIGN;
+        if(c <= CACHE_MAX / ALIGN && cached[c] > 0)
+        {
+            cached[c] --;
+            return HIDE(cache[c][cached[c]]);
+        }
+    }
+    return dalloc(request);
+}
+
+void dfree_shared(void *memory)
+{
+    if(memory == NULL)
+    {
+        return;
+    }
+    struct head *block = (struct head*) MAGIC(memory);
+    int c = block->size / ALIGN;
+    if(block->size <= CACHE_MAX && cached[c] < CACHE_SIZE)
+    {
+        cache[c][cached[c]] = block;
+        cached[c] ++;
+        return;
+    }
+    dfree(memory);
+}
+
+// Gives the blocks in the calling thread's cache back to the heap. A thread
+// should do this before it goes away, or its cached blocks are lost.
+void dshared_flush()
+{
+    int c;
+    for(c = 0; c <= CACHE_MAX / ALIGN; c ++)
+    {
+        while(cached[c] > 0)
+        {
+            cached[c] --;
+            dfree(HIDE(cache[c][cached[c]]));
+        }
+    }
+}
+
+// Flushes the cache and unmaps the heap. It stays in the other processes, and
+// a heap opened by name stays until shm_unlink().
+void dshared_close()
+{
+    if(super == NULL)
+    {
+        return;
+    }
+    dshared_flush();
+    munmap(super, SUPER + arena_size);
+    super = NULL;
+    shared_sizes = NULL;
+    arena = NULL;
+    initiated = FALSE;
+}
@@ -0,0 +1,23 @@
+#include "../Merge/dlmall.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Shared heaps, see dshared_open() in dlmall.c
+int dshared_open(const char *name);
+int dshared_map(int fd);
+void dshared_close();
+void *dalloc_shared(size_t request);
+void dfree_shared(void *memory);
+void dshared_flush();
+void *droot();
+void dset_root(void *memory);
+uint32_t doffset(void *memory);
+void *dpointer(uint32_t offset);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "dlmall.h"
+
+#define REQ_UPPER 5 // upper number of dalloc requests/frees at once
+#define REQ_LOWER 1 // lower number of dalloc requests/frees at once
+
+void test1(int upper)
+{
+    // first request will always work
+    srand(time(NULL));
+    int i = 1;
+    int randomnumber;
+    randomnumber = (rand() % upper) + 1;
+
+    struct head *alloc = dalloc(randomnumber);
+    printf("%d SUCCESS: %d bytes allocated. %p\n",i, randomnumber, alloc);
+    i++;
+    while(alloc != NULL)
+    {
+        randomnumber = (rand() % upper) + 1;
+        alloc = dalloc(randomnumber);
+        if(alloc != NULL)
+        {
+            printf("%d SUCCESS: %d bytes allocated. %p\n",i, randomnumber, alloc);
+            i++;
+        }
+        else
+        {
+            printf("%d FAILURE\n", i);
+            i++;
+        }
+    }
+}
+
+void test2(volatile int loops, int av)
+{
+    // let's use 100 indices
+    struct head* procs[100]; 
+    int i;
+    for (i = 0; i < 100; i ++)
+    {
+        procs[i] = NULL;
+    }
+
+    int j = 0;
+
+    srand(time(NULL));
+    while(loops > 0)
+    { 
+        int randomnumber;
+        //printf("%d ", loops);
+        randomnumber = (rand() % 100);
+
+        if(procs[randomnumber] == NULL)
+        {
+            
+            int randalloc;
+            randalloc = (rand() % av) + 1;
+            struct head *temp = dalloc(randalloc);
+            if(temp == NULL)
+            {
+                //printf("MALLOC FAILED");
+                j ++;
+            }
+            else
+            {
+                procs[randomnumber] = temp;
+            }
+        }
+        else
+        {
+            struct head *temp = procs[randomnumber];
+            if(temp != NULL)
+            {
+                dfree(temp);
+            }
+            procs[randomnumber] = NULL;
+        }
+        loops --;
+    }
+
+    printf("I failed this much: %d. ", j);
+
+    //sanity();
+    
+
+}
+
+// Puts some text in the heap as its root and has a child process find it and
+// free it
+void test3()
+{
+    struct dstats before;
+    struct dstats after;
+    dstats(&before);
+    char *text = dalloc(32);
+    if(text == NULL)
+    {
+        printf("FAILED: nothing to share. ");
+        return;
+    }
+    strcpy(text, "shared with the child");
+    dset_root(text);
+
+    pid_t child = fork();
+    if(child == 0)
+    {
+        char *found = droot();
+        int seen = found != NULL && strcmp(found, "shared with the child") == 0;
+        dfree(found);
+        _exit(seen ? 0 : 1);
+    }
+    int status = 1;
+    waitpid(child, &status, 0);
+    dset_root(NULL);
+    dstats(&after);
+    if(child > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 && after.in_use == before.in_use)
+    {
+        printf("A child found and freed what its parent allocated. ");
+    }
+    else
+    {
+        printf("FAILED: the child did not find or free what its parent allocated. ");
+    }
+}
+
+int main()
+{
+    // Initialise our program memory
+    init();
+
+    test3();
+
+    // Perform tests as appropriate, e.g.
+    clock_t start, end;
+    double cpu_time_used;
+
+    start = clock();
+    test2(100000000,100);
+    end = clock();
+    cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
+
+    printf("I took: %f", cpu_time_used);
+
+    return 0;
+}
\ No newline at end of file